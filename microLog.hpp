@@ -55,16 +55,32 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 		  This allows to specify different minimum log levels for different kinds of log messages;
 		  localLevel can be a const or a variable.
 	- To flush the message use the uLOGE manipulator (stands for log-end) instead of std::endl!
+	- uLOGFMT(level, "x={} y={:.3f}", x, y) and uLOGFMT_(level, localLevel, ...) log a whole message from a format
+		  string checked at compile time; numbers are formatted without std::ostream (see Format).
+	- uLOG_EVERY_N(level, n), uLOG_FIRST_N(level, n) and uLOG_RATE(level, perSecond) log a part of the calls
+		  of a hot call site; the next message written reports the number of the skipped ones (see Sampler).
+	- uLOG(level) << "Closed" << uLOG_KV("fd", fd) << uLOGE adds a key-value: " fd=12" in the text,
+		  a typed member with MICRO_LOG_STRUCTURED (see Structured).
+	- Each message is built in a thread local buffer of maxLogSize bytes (longer messages are truncated),
+		  without heap allocations, and written to its stream at once by uLOGE.
+	- Messages to microLog_ofs are flushed according to uLog::FlushPolicy, set before uLOG_START:
+		  always (default), from a given level, every N bytes/messages, every T ms, at exit/fatal.
 	- The output log file can be:
 		- Unique for this executable, with a global static variable file stream (microLog_ofs).
 		- Custom, with a stream passed as a parameter to every log message (TODO).
+		- Also copied to other sinks (MICRO_LOG_SINKS: files, streams, memory), each with its own
+		  level and fields (see Sinks).
 	- Multithreading: the MICRO_LOG_LOCK/MICRO_LOG_UNLOCK macros delimit a critical section.
 		- Their values depend on the adopted threading library, and can be defined in microLog_config.hpp.
 		- Predefined values available for: C++11 threads, Boost threads, pthread.
+		- Messages to microLog_ofs are written by group commit: the threads logging at the same time
+		  queue their messages, and one of them writes them all with a single writev() (POSIX).
 	- For better performance, log to a ramdisk and use an external utility to periodically move the logs to
 		  a permanent data storage.
+	- Client mode: the messages are written to a ring in shared memory, and the files by microLog_server.
 	- In case it is not possible to initialize microLog, or it is not possible to modify the main() function
 		  to call uLOG_START_APP(), you can use:  uLOGF(logfname, level, minLogLev, logMsg)
+		  Its files stay open in a small cache (POSIX, see FileCache).
 
 	Usage: See microLog_test.cpp as an example.
 
@@ -74,6 +90,45 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 		MICRO_LOG_ACTIVE      to add the logger calls to the executable (if set to 1).
 		MICRO_LOG_MIN_LEVEL   to set a minimum log level below which the logger call will not be added.
+		MICRO_LOG_FIELDS      to select the message fields at compile time, as a bit mask (e.g. MICRO_LOG_FIELDS_SYSTEM);
+		                      the static part of each message prefix is then built by the compiler.
+		                      Otherwise the fields are selected at run time with uLog::LogFields.
+		MICRO_LOG_TIME_PRECISION
+		                      number of sub-second digits of the date field: 0 (default), 3, 6, 9;
+		                      it can be changed at run time with uLog::Timestamp::Precision().
+		MICRO_LOG_SPACE_CHECK_INTERVAL
+		                      bytes logged between two checks of the space available for the log file.
+		MICRO_LOG_FILE_CACHE_SIZE
+		                      max number of uLOGF files kept open (default 8).
+		MICRO_LOG_RECORD_DEPTH
+		                      messages of a thread formatted at the same time, when an argument of
+		                      a message logs another one (default 4).
+		MICRO_LOG_ASYNC       to queue the log messages in memory and write them to the log file
+		                      from a background thread, started by uLOG_START.
+		MICRO_LOG_BINARY      to write the log file in a compact binary format, with the messages
+		                      formatted offline by microLog_decode (see BinaryLog).
+		MICRO_LOG_MMAP        to write the log file through preallocated memory mapped segments
+		                      of MICRO_LOG_MMAP_SEGMENT_SIZE bytes (POSIX, see MappedFile).
+		MICRO_LOG_ROTATION    to rotate the log file by size and/or time (POSIX, see Rotation);
+		                      with MICRO_LOG_ZLIB the rotated files are compressed.
+		MICRO_LOG_TIERING     to copy the log file (e.g. on a ramdisk) to a durable directory in
+		                      the background, freeing its space when low (POSIX, see Tiering).
+		MICRO_LOG_SINKS       to send the messages of uLOG also to up to MICRO_LOG_MAX_SINKS other
+		                      destinations, each with its own level and fields (see Sinks).
+		MICRO_LOG_CLIENT      to send the messages to microLog_server through a ring in shared memory;
+		                      the server writes the log files (Linux, see Client).
+		MICRO_LOG_LEVELS      to set at run time the minimum level of modules (uLOGM), files and
+		                      functions (see Levels).
+		MICRO_LOG_RELOAD      to reload the levels, fields and flush policy from a configuration
+		                      file when it changes, or on SIGHUP (POSIX, see Reload).
+		MICRO_LOG_RECORDER    to keep the messages below uLog::minLogLevel in a ring per thread,
+		                      written to the log file on an error, a crash, or on demand (POSIX,
+		                      see Recorder).
+		MICRO_LOG_COALESCE    to write the identical consecutive messages of a uLOG call site as a
+		                      single summary line, with their number and times (see Coalescer).
+		MICRO_LOG_STRUCTURED  MICRO_LOG_JSON or MICRO_LOG_LOGFMT: to write the uLOG messages as JSON
+		                      lines or logfmt lines, with the LogFields fields and the uLOG_KV
+		                      key-values (see Structured).
 */
 
 #ifndef MICRO_LOG_HPP
@@ -98,9 +153,17 @@ namespace uLog {
 // Import logger's configuration
 #include "microLog_config.hpp"
 
+#ifndef MICRO_LOG_SEPARATOR
+	#define MICRO_LOG_SEPARATOR "  "     // fields separator, as uLog::separator
+#endif
+
 #ifdef MICRO_LOG_ACTIVE
 
+	#include <atomic>
 	#include <bitset>
+	#include <cerrno>
+	#include <chrono>
+	#include <cmath>
 	#include <cstdio>
 	#include <cstring>
 	#include <ctime>
@@ -108,7 +171,10 @@ namespace uLog {
 	#include <fstream>
 	#include <iomanip>
 	#include <iostream>
+	#include <streambuf>
 	#include <string>
+	#include <tuple>
+	#include <type_traits>
 	#include <vector>
 
 	#ifndef MICRO_LOG_EXECUTABLE_NAME
@@ -118,11 +184,18 @@ namespace uLog {
 	#if(MICRO_LOG_THREADING == MICRO_LOG_CPP11_THREAD)
 		#include <mutex>
 	#elif(MICRO_LOG_THREADING == MICRO_LOG_BOOST_THREAD)
+		#include <boost/thread/lock_guard.hpp>
+		#include <boost/thread/mutex.hpp>
 		#include <boost/thread/thread.hpp>
 	#elif(MICRO_LOG_THREADING == MICRO_LOG_PTHREAD)
 		#include <pthread.h>
 	#endif
 
+	#if defined(MICRO_LOG_THREADING) && (MICRO_LOG_THREADING != MICRO_LOG_SINGLE_THREAD)
+		#include <condition_variable>
+		#include <mutex>
+	#endif
+
 	#ifndef MICRO_LOG_BOOST         // Boost used by default
 		#define MICRO_LOG_BOOST 1
 	#endif
@@ -131,7 +204,88 @@ namespace uLog {
 		#include <boost/filesystem.hpp>
 	#endif
 
+	#ifdef MICRO_LOG_ASYNC
+		#include <cstdlib>
+		#include <mutex>
+		#include <thread>
+	#endif
+
+	#ifdef MICRO_LOG_MMAP
+		#include <cstdlib>
+		#include <sched.h>
+		#include <sys/mman.h>
+	#endif
+
+	#ifdef MICRO_LOG_ROTATION
+		#include <algorithm>
+		#include <condition_variable>
+		#include <cstdlib>
+		#include <mutex>
+		#include <thread>
+		#include <dirent.h>
+		#include <sys/resource.h>
+		#include <sys/stat.h>
+		#include <sys/syscall.h>
+		#ifdef MICRO_LOG_ZLIB
+			#include <zlib.h>
+		#endif
+	#endif
+
+	#ifdef MICRO_LOG_TIERING
+		#include <condition_variable>
+		#include <cstdlib>
+		#include <mutex>
+		#include <thread>
+		#include <sys/stat.h>
+		#ifdef __linux__
+			#include <sys/sendfile.h>
+		#endif
+	#endif
+
+	#ifdef MICRO_LOG_RELOAD
+		#include <csignal>
+		#include <cstdlib>
+		#include <mutex>
+		#include <sstream>
+		#include <thread>
+		#include <poll.h>
+		#include <sys/stat.h>
+		#ifdef __linux__
+			#include <sys/inotify.h>
+		#endif
+	#endif
+
+	#ifdef MICRO_LOG_LEVELS
+		#include <cstdlib>
+		#include <mutex>
+	#endif
+
+	#ifdef MICRO_LOG_RECORDER
+		#include <algorithm>
+		#include <csignal>
+	#endif
+
+	#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+		#include <mutex>
+	#endif
+
+	#if defined(MICRO_LOG_CLIENT) || defined(MICRO_LOG_SERVER)
+		#include <climits>
+		#include <cstdlib>
+		#include <thread>
+		#include <poll.h>
+		#include <sys/eventfd.h>
+		#include <sys/mman.h>
+		#include <sys/socket.h>
+		#include <sys/un.h>
+	#endif
+
 	#ifndef WIN32
+		#include <fcntl.h>
+		#include <pthread.h>
+		#include <sched.h>
+		#include <sys/mman.h>
+		#include <sys/uio.h>
 		#include <unistd.h>
 	#else
 		#include <process.h>
@@ -146,17 +300,104 @@ namespace uLog {
 namespace uLog {
 
 	struct Statistics
+		/// Message counters and latencies, per thread: each thread writes only its own Counters
+		/// (padded to their own cache lines) with relaxed atomics; Sum() adds them up.
+		/// called: uLOG calls passing the level check, by level (the rejected ones are not
+		/// counted: see LevelEnabled()); emitted: messages written to their stream (or queued
+		/// to the writer thread / log server); dropped: by the overload policy or for lack of space.
+		/// Latencies (ns, when latency is set): format, from the start of a message to uLOGE;
+		/// write, of uLOGE (to the file, queue or sinks).
 	{
-		#ifndef MICRO_LOG_DLL
-		static int nLogs;
-		static int nNoLogs, nVerboseLogs, nDetailLogs, nInfoLogs, nWarningLogs, nErrorLogs, nCriticalLogs, nFatalLogs;
-		static int highestLevel;
+		#if defined(MICRO_LOG_ACTIVE) && !defined(MICRO_LOG_DLL)
+		struct Histogram
+			/// HDR-style: exact up to 15 ns, then 8 linear buckets per power of 2 (within 12.5%), up to 2^40 ns
+		{
+			static const int nBuckets = 16 + (40 - 4) * 8;
+
+			std::atomic<unsigned long long> count[nBuckets];
+
+			static int Bucket(unsigned long long ns);
+			static unsigned long long Value(int bucket);       // highest value in bucket
+		};
+
+		struct Counters
+		{
+			char                            pad0[64];
+			std::atomic<bool>               inUse;             // by a running thread
+			Counters                       *next;
+			std::atomic<unsigned long long> called[nLogLevels], emitted[nLogLevels], dropped, bytes;
+			Histogram                       format, write;
+			char                            pad1[64];
+
+			static void Add(std::atomic<unsigned long long> &c, unsigned long long n = 1) {
+				c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);   // single writer
+			}
+		};
+
+		struct Totals
+		{
+			unsigned long long called[nLogLevels], emitted[nLogLevels], dropped, bytes;
+			unsigned long long format[Histogram::nBuckets], write[Histogram::nBuckets];
+
+			unsigned long long Called() const;
+			unsigned long long Emitted() const;
+			static unsigned long long Count(const unsigned long long *histogram);
+			static unsigned long long Percentile(const unsigned long long *histogram, double p);
+		};
+
+		struct Snapshot
+			/// Exported to shared memory by Export(); seq is odd while it is being updated
+		{
+			char                            magic[8];          // "uLOGstat"
+			unsigned                        version;
+			int                             pid;
+			std::atomic<unsigned>           seq;
+			long long                       time;              // ns since epoch
+			double                          bytesPerSecond;    // since uLOG_START
+			unsigned long long              formatNs[4], writeNs[4];    // p50, p99, p99.9, max
+			Totals                          totals;
+		};
+
+		static std::atomic<Counters*> all;         // counters of all the threads, ever
+		static bool                   latency;     // measure the latencies (two clock reads per message)
+		static Snapshot              *snapshot;    // exported, if not nullptr
+		static std::string            snapshotName;
+
+		static Counters& Local();
+		static void Sum(Totals &t);
+		static void Emitted(int level, size_t bytes);
+		static void Dropped();
+		static void Latency(long long formatNs, long long writeNs);
+		static long long Clock();
+		static bool Export(const std::string &name = std::string());
 		#endif
 		static void Update(int level);
 		static void Log();
 	};
 
-	extern int minLogLevel;                  // minimum level a message must have to be logged
+	#ifdef MICRO_LOG_ACTIVE
+	#if defined(MICRO_LOG_LEVELS) || defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+	struct GlobalLevel
+		/// uLog::minLogLevel with MICRO_LOG_LEVELS, MICRO_LOG_SINKS or MICRO_LOG_RECORDER: an
+		/// atomic int whose changes also update the combined thresholds (see UpdateThresholds()),
+		/// so that a rejected message costs a single load
+	{
+		std::atomic<int> value;
+
+		constexpr GlobalLevel(int level) : value(level) {}
+
+		int load(std::memory_order order = std::memory_order_seq_cst) const { return value.load(order); }
+		void store(int level, std::memory_order order = std::memory_order_seq_cst);
+		int operator=(int level) { store(level); return level; }
+		operator int() const { return load(); }
+	};
+	#else
+	typedef std::atomic<int> GlobalLevel;
+	#endif
+	extern GlobalLevel minLogLevel;          // minimum level a message must have to be logged
+	#else
+	extern int minLogLevel;
+	#endif
 	extern int loggerStatus;                 // OK=0, error otherwise
 	extern std::string logFilename;
 
@@ -173,8 +414,43 @@ namespace uLog {
 	                 backup_nothing_todo = 3,
 	                 backup_error        = -1;
 
+	// Asynchronous mode: what a thread does when the message queue is full
+
+	static const int
+	    async_block            = 0,     // wait for the writer thread to free a slot
+	    async_drop             = 1,     // discard the message
+	    async_drop_below_level = 2;     // discard the message if below a given level, otherwise wait
+
 	inline int BackupPrevLog(int mode = backup_append, const std::string &backupPath = std::string());
 
+	// Fields bit masks, to select the fields at compile time (#define MICRO_LOG_FIELDS mask)
+	// or at run time (LogFields::SetMask)
+
+	#define MICRO_LOG_FIELD_TIME       0x0001
+	#define MICRO_LOG_FIELD_DATE       0x0002
+	#define MICRO_LOG_FIELD_LEVEL      0x0004
+	#define MICRO_LOG_FIELD_EXEC       0x0008
+	#define MICRO_LOG_FIELD_PID        0x0010
+	#define MICRO_LOG_FIELD_UID        0x0020
+	#define MICRO_LOG_FIELD_UNAME      0x0040
+	#define MICRO_LOG_FIELD_FILE_NAME  0x0080
+	#define MICRO_LOG_FIELD_FILE_PATH  0x0100
+	#define MICRO_LOG_FIELD_FUNC_NAME  0x0200
+	#define MICRO_LOG_FIELD_FUNC_SIG   0x0400
+	#define MICRO_LOG_FIELD_LINE       0x0800
+	#define MICRO_LOG_FIELD_LOG        0x1000
+
+	// Presets, as LogFields::Set*()
+	#define MICRO_LOG_FIELDS_DEFAULT   (MICRO_LOG_FIELD_DATE | MICRO_LOG_FIELD_LEVEL | MICRO_LOG_FIELD_LOG)
+	#define MICRO_LOG_FIELDS_DETAILED  (MICRO_LOG_FIELD_TIME | MICRO_LOG_FIELD_DATE | MICRO_LOG_FIELD_LEVEL | MICRO_LOG_FIELD_EXEC | MICRO_LOG_FIELD_LOG)
+	#define MICRO_LOG_FIELDS_SYSTEM    (MICRO_LOG_FIELD_DATE | MICRO_LOG_FIELD_LEVEL | MICRO_LOG_FIELD_EXEC | MICRO_LOG_FIELD_PID | MICRO_LOG_FIELD_UID | \
+	                                    MICRO_LOG_FIELD_UNAME | MICRO_LOG_FIELD_FILE_NAME | MICRO_LOG_FIELD_LOG)
+	#define MICRO_LOG_FIELDS_DEBUG     (MICRO_LOG_FIELD_LEVEL | MICRO_LOG_FIELD_EXEC | MICRO_LOG_FIELD_FILE_NAME | MICRO_LOG_FIELD_FUNC_NAME | \
+	                                    MICRO_LOG_FIELD_LINE | MICRO_LOG_FIELD_LOG)
+	#define MICRO_LOG_FIELDS_VERBOSE   (MICRO_LOG_FIELD_TIME | MICRO_LOG_FIELD_DATE | MICRO_LOG_FIELD_LEVEL | MICRO_LOG_FIELD_EXEC | MICRO_LOG_FIELD_PID | \
+	                                    MICRO_LOG_FIELD_UID | MICRO_LOG_FIELD_UNAME | MICRO_LOG_FIELD_FILE_PATH | MICRO_LOG_FIELD_FUNC_SIG | \
+	                                    MICRO_LOG_FIELD_LINE | MICRO_LOG_FIELD_LOG)
+
 	// Run time fields selection
 
 	struct LogFields
@@ -230,6 +506,30 @@ namespace uLog {
 			log = true;
 		}
 
+		static void SetMask(unsigned mask) {
+			time     = (mask & MICRO_LOG_FIELD_TIME) != 0;
+			date     = (mask & MICRO_LOG_FIELD_DATE) != 0;
+			llevel   = (mask & MICRO_LOG_FIELD_LEVEL) != 0;
+			exec     = (mask & MICRO_LOG_FIELD_EXEC) != 0;
+			pid      = (mask & MICRO_LOG_FIELD_PID) != 0;
+			uid      = (mask & MICRO_LOG_FIELD_UID) != 0;
+			uname    = (mask & MICRO_LOG_FIELD_UNAME) != 0;
+			fileName = (mask & MICRO_LOG_FIELD_FILE_NAME) != 0;
+			filePath = (mask & MICRO_LOG_FIELD_FILE_PATH) != 0;
+			funcName = (mask & MICRO_LOG_FIELD_FUNC_NAME) != 0;
+			funcSig  = (mask & MICRO_LOG_FIELD_FUNC_SIG) != 0;
+			line     = (mask & MICRO_LOG_FIELD_LINE) != 0;
+			log      = (mask & MICRO_LOG_FIELD_LOG) != 0;
+		}
+
+		static unsigned Mask() {
+			return (time ? MICRO_LOG_FIELD_TIME : 0) | (date ? MICRO_LOG_FIELD_DATE : 0) | (llevel ? MICRO_LOG_FIELD_LEVEL : 0) |
+			       (exec ? MICRO_LOG_FIELD_EXEC : 0) | (pid ? MICRO_LOG_FIELD_PID : 0) | (uid ? MICRO_LOG_FIELD_UID : 0) |
+			       (uname ? MICRO_LOG_FIELD_UNAME : 0) | (fileName ? MICRO_LOG_FIELD_FILE_NAME : 0) |
+			       (filePath ? MICRO_LOG_FIELD_FILE_PATH : 0) | (funcName ? MICRO_LOG_FIELD_FUNC_NAME : 0) |
+			       (funcSig ? MICRO_LOG_FIELD_FUNC_SIG : 0) | (line ? MICRO_LOG_FIELD_LINE : 0) | (log ? MICRO_LOG_FIELD_LOG : 0);
+		}
+
 		static void SetVerbose() {
 			time = true; date = true;
 			llevel = true;
@@ -258,6 +558,11 @@ namespace uLog {
 		#endif
 		// End: Platform specific
 
+		constexpr size_t BaseNameOffset(const char *path, size_t i = 0, size_t offset = 0) {
+			// Offset of the file name in a path (computed at compile time for __FILE__)
+			return path[i] == '\0' ? offset : BaseNameOffset(path, i + 1, path[i] == MICRO_LOG_DIR_SLASH ? i + 1 : offset);
+		}
+
 		// Log stream: define it at global scope and open it (in append mode) before logging
 		extern std::ofstream microLog_ofs;
 
@@ -265,30 +570,415 @@ namespace uLog {
 			#define MICRO_LOG_MIN_LEVEL 2
 		#endif
 
+		#ifndef MICRO_LOG_SPACE_CHECK_INTERVAL
+			#define MICRO_LOG_SPACE_CHECK_INTERVAL 65536    // bytes logged between two checks of the available space
+		#endif
+
+		#ifndef MICRO_LOG_FILE_CACHE_SIZE
+			#define MICRO_LOG_FILE_CACHE_SIZE 8             // max number of uLOGF files kept open
+		#endif
+
+		#ifndef MICRO_LOG_RECORD_DEPTH
+			#define MICRO_LOG_RECORD_DEPTH 4                // records per thread, for the nested messages
+		#endif
+
+		#ifdef MICRO_LOG_FIELDS
+			#define uLOG_START_FIELDS  uLog::LogFields::SetMask(MICRO_LOG_FIELDS);   // for uLOG_TITLES
+		#else
+			#define uLOG_START_FIELDS
+		#endif
+
+		#ifndef MICRO_LOG_FLUSH_BUFFER_SIZE
+			#define MICRO_LOG_FLUSH_BUFFER_SIZE 65536       // file buffer size when not flushing every message (bytes)
+		#endif
+
+		#define uLOG_INIT_FLUSH                                                                            \
+			int FlushPolicy::level = nolog;                                                                \
+			size_t FlushPolicy::bytes = 0, FlushPolicy::records = 0;                                       \
+			long FlushPolicy::interval = 0;                                                                \
+			bool FlushPolicy::atExit = true;                                                               \
+			size_t FlushPolicy::pendingBytes = 0, FlushPolicy::pendingRecords = 0;                         \
+			long long FlushPolicy::lastFlush = 0;                                                          \
+			unsigned long FlushPolicy::nFlushes = 0, FlushPolicy::nLevelFlushes = 0, FlushPolicy::nSizeFlushes = 0, \
+			              FlushPolicy::nTimeFlushes = 0, FlushPolicy::nExitFlushes = 0;
+
+		// Binary mode settings
+		#ifdef MICRO_LOG_BINARY
+			#define uLOG_INIT_BINARY                                                                   \
+				std::atomic<const Binary::Site*> Binary::sites(nullptr);                               \
+				std::atomic<unsigned> Binary::nSites(0);
+
+			#define uLOG_START_BINARY  uLog::Binary::Start();
+			#define uLOG_OPEN_MODE     (std::fstream::app | std::fstream::binary)
+		#else
+			#define uLOG_INIT_BINARY
+			#define uLOG_START_BINARY
+			#define uLOG_OPEN_MODE     std::fstream::app
+		#endif
+
+		// Memory mapped log file settings
+		#ifdef MICRO_LOG_MMAP
+			#ifdef MICRO_LOG_ASYNC
+				#error "MICRO_LOG_MMAP and MICRO_LOG_ASYNC are alternatives: the threads already write to the mapped file without waiting."
+			#endif
+			#ifndef MICRO_LOG_MMAP_SEGMENT_SIZE
+				#define MICRO_LOG_MMAP_SEGMENT_SIZE (64 << 20)     // bytes preallocated and mapped at once
+			#endif
+
+			#define uLOG_INIT_MMAP                                                                     \
+				int MappedFile::fd = -1;                                                               \
+				size_t MappedFile::segmentSize = MICRO_LOG_MMAP_SEGMENT_SIZE;                          \
+				std::atomic<unsigned long long> MappedFile::tail(0);                                   \
+				unsigned long long MappedFile::head = 0;                                               \
+				MappedFile::Slot MappedFile::slots[MappedFile::nSlots];                                \
+				std::atomic<unsigned long> MappedFile::nSegments(0), MappedFile::nFailures(0);
+
+			#define uLOG_START_MMAP                                                                    \
+				if(!uLog::MappedFile::Open(uLog::logFilename))                                         \
+					std::cerr << "Cannot map the log file, writing it as a stream." << std::endl;
+		#else
+			#define uLOG_INIT_MMAP
+			#define uLOG_START_MMAP
+		#endif
+
+		// Log rotation settings
+		#ifdef MICRO_LOG_ROTATION
+			#ifdef MICRO_LOG_MMAP
+				#error "MICRO_LOG_ROTATION is not available with MICRO_LOG_MMAP."
+			#endif
+
+			#define uLOG_INIT_ROTATION                                                                 \
+				unsigned long long Rotation::maxBytes = 0;                                             \
+				long Rotation::interval = 0;                                                           \
+				int Rotation::keep = 0;                                                                \
+				bool Rotation::compress = true;                                                        \
+				std::atomic<unsigned long long> Rotation::bytes(0);                                    \
+				std::atomic<long long> Rotation::deadline(0);                                          \
+				std::atomic<unsigned long> Rotation::nRotations(0), Rotation::nDeferred(0);            \
+				std::mutex Rotation::mutex;                                                            \
+				std::condition_variable Rotation::cond;                                                \
+				std::ofstream Rotation::next;                                                          \
+				int Rotation::nextFd = -1;                                                             \
+				bool Rotation::nextReady = false, Rotation::stop = false;                              \
+				std::thread Rotation::worker;
+
+			#define uLOG_START_ROTATION  uLog::Rotation::Start();
+		#else
+			#define uLOG_INIT_ROTATION
+			#define uLOG_START_ROTATION
+		#endif
+
+		// Ramdisk tiering settings
+		#ifdef MICRO_LOG_TIERING
+			#ifdef MICRO_LOG_ROTATION
+				#error "MICRO_LOG_TIERING is not available with MICRO_LOG_ROTATION."
+			#endif
+
+			#ifndef MICRO_LOG_TIERING_CHUNK
+				#define MICRO_LOG_TIERING_CHUNK  (8 << 20)    // bytes copied per system call
+			#endif
+
+			#define uLOG_INIT_TIERING                                                                  \
+				std::string Tiering::path;                                                             \
+				long Tiering::interval = 60;                                                           \
+				unsigned long long Tiering::lowWatermark = 0;                                          \
+				std::atomic<unsigned long long> Tiering::committed(0);                                 \
+				unsigned long long Tiering::pending = 0;                                               \
+				unsigned long long Tiering::drained = 0, Tiering::durableLen = 0, Tiering::punched = 0; \
+				int Tiering::hotFd = -1, Tiering::durableFd = -1, Tiering::stateFd = -1;               \
+				bool Tiering::copyRange = true;                                                        \
+				std::atomic<unsigned long long> Tiering::nBytes(0), Tiering::nFreed(0);                \
+				std::atomic<unsigned long> Tiering::nDrains(0), Tiering::nErrors(0);                   \
+				std::atomic<bool> Tiering::lowSpace(false);                                            \
+				std::mutex Tiering::mutex;                                                             \
+				std::condition_variable Tiering::cond;                                                 \
+				bool Tiering::stop = false, Tiering::wake = false;                                     \
+				std::thread Tiering::worker;
+
+			#define uLOG_START_TIERING_RECOVER  uLog::Tiering::Recover();
+			#define uLOG_START_TIERING          uLog::Tiering::Start();
+		#else
+			#define uLOG_INIT_TIERING
+			#define uLOG_START_TIERING_RECOVER
+			#define uLOG_START_TIERING
+		#endif
+
+		// Sinks settings
+		#ifdef MICRO_LOG_SINKS
+			#ifdef MICRO_LOG_BINARY
+				#error "MICRO_LOG_SINKS is not available with MICRO_LOG_BINARY."
+			#endif
+
+			#ifndef MICRO_LOG_MAX_SINKS
+				#define MICRO_LOG_MAX_SINKS  8
+			#endif
+			#if MICRO_LOG_MAX_SINKS > 32
+				#error "MICRO_LOG_MAX_SINKS must not be more than 32."
+			#endif
+
+			#define uLOG_INIT_SINKS                                                                    \
+				Sink Sinks::sinks[MICRO_LOG_MAX_SINKS];                                                \
+				std::atomic<int> Sinks::count(0);                                                      \
+				std::atomic<int> minSinkLevel(nLogLevels);
+		#else
+			#define uLOG_INIT_SINKS
+		#endif
+
+		// Log server settings
+		#if defined(MICRO_LOG_CLIENT) || defined(MICRO_LOG_SERVER)
+			#ifndef MICRO_LOG_SERVER_SOCKET
+				#define MICRO_LOG_SERVER_SOCKET  "/tmp/microLog.sock"
+			#endif
+			#ifndef MICRO_LOG_CLIENT_RING_SIZE
+				#define MICRO_LOG_CLIENT_RING_SIZE  1024       // number of messages (rounded up to a power of 2)
+			#endif
+		#endif
+
+		#ifdef MICRO_LOG_CLIENT
+			#if defined(MICRO_LOG_ASYNC) || defined(MICRO_LOG_BINARY) || defined(MICRO_LOG_MMAP) || defined(MICRO_LOG_ROTATION) || defined(MICRO_LOG_TIERING)
+				#error "MICRO_LOG_CLIENT: the log file is written by microLog_server, build it with these options instead."
+			#endif
+
+			#define uLOG_INIT_CLIENT                                                                   \
+				std::string Client::socketPath = MICRO_LOG_SERVER_SOCKET;                              \
+				std::atomic<SharedRing*> Client::ring(nullptr);                                        \
+				size_t Client::ringSize = 0;                                                           \
+				int Client::sock = -1, Client::eventFd = -1, Client::pid = 0;                          \
+				std::atomic<unsigned long> Client::nQueued(0), Client::nBlocked(0), Client::nWakeups(0);
+
+			#define uLOG_CLIENT_ATTACH  uLog::Client::Attach(uLog::logFilename)
+		#else
+			#define uLOG_INIT_CLIENT
+			#define uLOG_CLIENT_ATTACH  false
+		#endif
+
+		// Level registry settings
+		#ifdef MICRO_LOG_LEVELS
+			#define uLOG_INIT_LEVELS                                                                   \
+				std::atomic<unsigned long long> Levels::generation(1);                                 \
+				std::atomic<int> Levels::minLevel(nLogLevels);                                         \
+				std::atomic<int> Levels::threshold(uLOG_LOWEST_LEVEL);                                 \
+				std::atomic<const Levels::Rules*> Levels::rules(nullptr);                              \
+				std::vector<const Levels::Rules*> Levels::retired;                                     \
+				std::mutex Levels::mutex;
+		#else
+			#define uLOG_INIT_LEVELS
+		#endif
+
+		// Configuration reload settings
+		#ifdef MICRO_LOG_RELOAD
+			#ifndef MICRO_LOG_RELOAD_INTERVAL
+				#define MICRO_LOG_RELOAD_INTERVAL  1000     // ms between two checks of the file, without inotify
+			#endif
+
+			#define uLOG_INIT_RELOAD                                                                   \
+				std::string Reload::path;                                                              \
+				bool Reload::sighup = true;                                                            \
+				std::atomic<const Reload::Config*> Reload::config(nullptr);                            \
+				std::vector<const Reload::Config*> Reload::retired;                                    \
+				const Reload::Config *Reload::flushApplied = nullptr;                                  \
+				long long Reload::mtime = 0;                                                           \
+				std::atomic<unsigned long> Reload::nReloads(0), Reload::nErrors(0);                    \
+				std::mutex Reload::mutex;                                                              \
+				int Reload::wakeFd[2] = { -1, -1 }, Reload::inotifyFd = -1;                            \
+				std::atomic<bool> Reload::stop(false);                                                 \
+				std::thread Reload::worker;
+
+			#define uLOG_START_RELOAD  uLog::Reload::Start();
+		#else
+			#define uLOG_INIT_RELOAD
+			#define uLOG_START_RELOAD
+		#endif
+
+		// Flight recorder settings
+		#ifdef MICRO_LOG_RECORDER
+			#ifdef MICRO_LOG_BINARY
+				#error "MICRO_LOG_RECORDER is not available with MICRO_LOG_BINARY."
+			#endif
+
+			#ifndef MICRO_LOG_RECORDER_SIZE
+				#define MICRO_LOG_RECORDER_SIZE  65536       // bytes of the ring of each thread (a power of 2)
+			#endif
+			#ifndef MICRO_LOG_RECORDER_THREADS
+				#define MICRO_LOG_RECORDER_THREADS  32       // max number of threads with a ring
+			#endif
+			#ifndef MICRO_LOG_RECORDER_LEVEL
+				#define MICRO_LOG_RECORDER_LEVEL  verbose    // lowest level recorded, at start
+			#endif
+
+			#define uLOG_INIT_RECORDER                                                                 \
+				std::atomic<int> minRecordLevel(MICRO_LOG_RECORDER_LEVEL);                             \
+				Recorder::Ring Recorder::rings[MICRO_LOG_RECORDER_THREADS];                            \
+				std::atomic<int> Recorder::dumpLevel(error);                                           \
+				bool Recorder::handleSignals = true;                                                   \
+				int Recorder::crashFd = -1;                                                            \
+				std::atomic_flag Recorder::dumping = ATOMIC_FLAG_INIT;                                 \
+				struct sigaction Recorder::previous[Recorder::nSignals];                               \
+				std::atomic<unsigned long> Recorder::nDumps(0), Recorder::nLost(0);
+
+			#define uLOG_START_RECORDER  uLog::Recorder::Start();
+		#else
+			#define uLOG_INIT_RECORDER
+			#define uLOG_START_RECORDER
+		#endif
+
+		// Lowest level wanted by microLog_ofs, the sinks or the flight recorder, at start
+		#ifdef MICRO_LOG_RECORDER
+			#define uLOG_LOWEST_LEVEL  (MICRO_LOG_RECORDER_LEVEL < MICRO_LOG_MIN_LEVEL ? MICRO_LOG_RECORDER_LEVEL : MICRO_LOG_MIN_LEVEL)
+		#else
+			#define uLOG_LOWEST_LEVEL  MICRO_LOG_MIN_LEVEL
+		#endif
+
+		#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			#define uLOG_INIT_LOWEST  std::atomic<int> lowestLevel(uLOG_LOWEST_LEVEL);
+		#else
+			#define uLOG_INIT_LOWEST
+		#endif
+
+		// Coalescing settings
+		#ifdef MICRO_LOG_COALESCE
+			#ifdef MICRO_LOG_BINARY
+				#error "MICRO_LOG_COALESCE is not available with MICRO_LOG_BINARY."
+			#endif
+
+			#ifndef MICRO_LOG_COALESCE_WINDOW
+				#define MICRO_LOG_COALESCE_WINDOW  1000      // max time covered by a summary line (ms), at start
+			#endif
+			#ifndef MICRO_LOG_COALESCE_SITES
+				#define MICRO_LOG_COALESCE_SITES  4          // call sites tracked by each thread (a power of 2)
+			#endif
+
+			#define uLOG_INIT_COALESCE                                                                 \
+				std::atomic<int> Coalescer::windowMs(MICRO_LOG_COALESCE_WINDOW);
+		#else
+			#define uLOG_INIT_COALESCE
+		#endif
+
+		// Structured output settings
+		#define MICRO_LOG_JSON    1
+		#define MICRO_LOG_LOGFMT  2
+
+		#ifdef MICRO_LOG_STRUCTURED
+			#ifdef MICRO_LOG_BINARY
+				#error "MICRO_LOG_STRUCTURED is not available with MICRO_LOG_BINARY."
+			#endif
+			#if MICRO_LOG_STRUCTURED != MICRO_LOG_JSON && MICRO_LOG_STRUCTURED != MICRO_LOG_LOGFMT
+				#error "MICRO_LOG_STRUCTURED must be MICRO_LOG_JSON or MICRO_LOG_LOGFMT."
+			#endif
+
+			#ifndef MICRO_LOG_KV_SIZE
+				#define MICRO_LOG_KV_SIZE  256               // bytes of the uLOG_KV key-values of a message
+			#endif
+
+			// Keys, encoded at compile time: of a field of the prefix, and of a key-value
+			#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+				#define uLOG_FIELD_KEY(name)  "\"" name "\":"
+				#define uLOG_KEY(name)        ",\"" name "\":"
+				#define uLOG_TEXT_LINE(text)  "{\"msg\":\"" text "\"}\n"
+			#else
+				#define uLOG_FIELD_KEY(name)  name "="
+				#define uLOG_KEY(name)        " " name "="
+				#define uLOG_TEXT_LINE(text)  "msg=\"" text "\"\n"
+			#endif
+		#else
+			#define uLOG_KEY(name)        " " name "="
+			#define uLOG_TEXT_LINE(text)  text "\n"
+		#endif
+
+		#ifndef MICRO_LOG_TIME_PRECISION
+			#define MICRO_LOG_TIME_PRECISION 0      // sub-second digits of the date field: 0, 3, 6, 9
+		#endif
+
+		// Asynchronous mode settings
+		#ifdef MICRO_LOG_ASYNC
+			#ifndef MICRO_LOG_ASYNC_QUEUE_SIZE
+				#define MICRO_LOG_ASYNC_QUEUE_SIZE 1024       // number of messages (rounded up to a power of 2)
+			#endif
+			#ifndef MICRO_LOG_ASYNC_BATCH_SIZE
+				#define MICRO_LOG_ASYNC_BATCH_SIZE 65536      // max bytes written to file at once (bytes)
+			#endif
+			#ifndef MICRO_LOG_ASYNC_IDLE_US
+				#define MICRO_LOG_ASYNC_IDLE_US 1000          // writer thread sleep time when the queue is empty (us)
+			#endif
+
+			#define uLOG_INIT_ASYNC                                                                    \
+				std::atomic<int> Async::policy(async_block), Async::dropLevel(warning);                \
+				std::atomic<unsigned long> Async::nQueued(0), Async::nDropped(0), Async::nBlocked(0),  \
+				                           Async::nBatches(0);                                         \
+				Async::Queue Async::queue;                                                             \
+				std::thread Async::writer;                                                             \
+				std::atomic<bool> Async::running(false), Async::stop(false);                           \
+				std::atomic<unsigned> Async::inFlight(0);                                              \
+				std::mutex Async::fileMutex;
+
+			#define uLOG_START_ASYNC  uLog::Async::Start();
+		#else
+			#define uLOG_INIT_ASYNC
+			#define uLOG_START_ASYNC
+		#endif
+
 		// microLog initialization:
 		// Use this macro once in the main()'s file at global scope
 
 		#ifndef MICRO_LOG_DLL
 			#define uLOG_INIT_0                          \
 				namespace uLog {                         \
-				int minLogLevel = MICRO_LOG_MIN_LEVEL;   \
+				GlobalLevel minLogLevel(MICRO_LOG_MIN_LEVEL);  \
 				int loggerStatus = 0;                    \
 				std::string logFilename;                 \
 				std::ofstream microLog_ofs;              \
-				int Statistics::nLogs = 0, Statistics::nNoLogs = 0, Statistics::nVerboseLogs = 0, Statistics::nDetailLogs = 0, Statistics::nInfoLogs = 0, Statistics::nWarningLogs = 0, Statistics::nErrorLogs = 0, Statistics::nCriticalLogs = 0, Statistics::nFatalLogs = 0; \
-				int Statistics::highestLevel = 0;                                                                                       \
+				SpaceGuard spaceGuard(logFilename);      \
+				ProcessFields::Field ProcessFields::exec, ProcessFields::pid, ProcessFields::uid, ProcessFields::uname;                 \
+				std::atomic<bool> ProcessFields::ready(false);                                                                          \
+				std::atomic<Statistics::Counters*> Statistics::all(nullptr);                                                           \
+				bool Statistics::latency = true;                                                                                        \
+				Statistics::Snapshot *Statistics::snapshot = nullptr;                                                                   \
+				std::string Statistics::snapshotName;                                                                                   \
 				bool LogFields::time = false, LogFields::date = true, LogFields::llevel = true, LogFields::exec = false,                \
 					 LogFields::uid = false, LogFields::uname = false, LogFields::pid = false,                                          \
 					 LogFields::fileName = false, LogFields::filePath = false, LogFields::funcName = false, LogFields::funcSig = false, \
 					 LogFields::line = false, LogFields::log = true;                                                                    \
+				uLOG_INIT_FLUSH                                                                                                         \
+				uLOG_INIT_MUTEX                                                                                                         \
+				uLOG_INIT_ASYNC                                                                                                         \
+				uLOG_INIT_GROUP_COMMIT                                                                                                  \
+				uLOG_INIT_BINARY                                                                                                        \
+				uLOG_INIT_MMAP                                                                                                          \
+				uLOG_INIT_ROTATION                                                                                                      \
+				uLOG_INIT_TIERING                                                                                                       \
+				uLOG_INIT_SINKS                                                                                                         \
+				uLOG_INIT_LOWEST                                                                                                        \
+				uLOG_INIT_CLIENT                                                                                                        \
+				uLOG_INIT_LEVELS                                                                                                        \
+				uLOG_INIT_RELOAD                                                                                                        \
+				uLOG_INIT_RECORDER                                                                                                      \
+				uLOG_INIT_COALESCE                                                                                                      \
 				}
 		#else
 			#define uLOG_INIT_0                          \
 				namespace uLog {                         \
-				int minLogLevel = MICRO_LOG_MIN_LEVEL;   \
+				GlobalLevel minLogLevel(MICRO_LOG_MIN_LEVEL);  \
 				int loggerStatus = 0;                    \
 				std::string logFilename;                 \
 				std::ofstream microLog_ofs;              \
+				SpaceGuard spaceGuard(logFilename);      \
+				ProcessFields::Field ProcessFields::exec, ProcessFields::pid, ProcessFields::uid, ProcessFields::uname;  \
+				std::atomic<bool> ProcessFields::ready(false);  \
+				uLOG_INIT_FLUSH                          \
+				uLOG_INIT_MUTEX                          \
+				uLOG_INIT_ASYNC                          \
+				uLOG_INIT_GROUP_COMMIT                   \
+				uLOG_INIT_BINARY                         \
+				uLOG_INIT_MMAP                           \
+				uLOG_INIT_ROTATION                       \
+				uLOG_INIT_TIERING                        \
+				uLOG_INIT_SINKS                          \
+				uLOG_INIT_LOWEST                         \
+				uLOG_INIT_CLIENT                         \
+				uLOG_INIT_LEVELS                         \
+				uLOG_INIT_RELOAD                         \
+				uLOG_INIT_RECORDER                       \
+				uLOG_INIT_COALESCE                       \
 				}
 		#endif
 
@@ -297,12 +987,30 @@ namespace uLog {
         #define uLOG_START(logFilename_, backup_mode)                          \
 	        uLog::logFilename = logFilename_;                                  \
 	        uLog::loggerStatus = 0;                                            \
+	        uLog::Timestamp::Anchor();                                         \
+	        uLog::spaceGuard.Reset();                                          \
+	        uLog::ProcessFields::Update();                                     \
+	        uLOG_START_FIELDS                                                  \
+	        uLOG_START_RELOAD                                                  \
+	        uLOG_START_TIERING_RECOVER                                         \
+	        if(!uLOG_CLIENT_ATTACH) {                                          \
 	        uLog::BackupPrevLog(backup_mode);                                  \
-	        uLog::microLog_ofs.open(uLog::logFilename, std::fstream::app);     \
+	        uLog::FlushPolicy::Start();                                        \
+	        uLog::microLog_ofs.open(uLog::logFilename, uLOG_OPEN_MODE);        \
 	        if(!uLog::microLog_ofs) {                                          \
 	            uLog::loggerStatus = -1;                                       \
 	            std::cerr << "Error opening log file. Cannot produce logs. Check if disk space is available." << std::endl;  \
-			}
+			}                                                                  \
+			else {                                                             \
+				uLOG_START_MMAP                                                \
+				uLOG_START_BINARY                                              \
+				uLOG_START_ASYNC                                               \
+				uLOG_START_GROUP_COMMIT                                        \
+				uLOG_START_ROTATION                                            \
+				uLOG_START_TIERING                                             \
+			}                                                                  \
+	        }                                                                  \
+	        uLOG_START_RECORDER
 
 		// Multithreading: macros used to define a critical section
 		//                 according to the adopted threading library:
@@ -314,61 +1022,79 @@ namespace uLog {
 		// Single threaded program
 		#if(MICRO_LOG_THREADING == MICRO_LOG_SINGLE_THREAD)
 
-			#define uLOG_INIT uLOG_INIT_0
+			#define uLOG_INIT_MUTEX
 			#define MICRO_LOG_LOCK {
 			#define MICRO_LOG_UNLOCK }
 
 		// C++11 Thread library
 		#elif(MICRO_LOG_THREADING == MICRO_LOG_CPP11_THREAD)
 
-			#define uLOG_INIT uLOG_INIT_0
+			extern std::mutex logMutex;
+
+			#define uLOG_INIT_MUTEX  std::mutex logMutex;
 
 			#define MICRO_LOG_LOCK                                          \
 				{                                                           \
-					std::mutex ulog_mutex;                                  \
-					ulog_mutex.lock();
+					std::lock_guard<std::mutex> ulog_lock(uLog::logMutex);
 			#define MICRO_LOG_UNLOCK                                        \
-					ulog_mutex.unlock();                                    \
 				}
 
-		// Boost Thread library      //+TODO
+		// Boost Thread library
 		#elif(MICRO_LOG_THREADING == MICRO_LOG_BOOST_THREAD)
 
-			#define MICRO_LOG_INIT                                          \
-				MICRO_LOG_INIT_0;                                           \
-				;
+			extern boost::mutex logMutex;
 
-			// Use this macro once in the main() function, before any log
-			#define MICRO_LOG_START(logFile)                                \
-				microLog_ofs.open((logFile))
-			#define MICRO_LOG_START_APPEND(logFile)                         \
-				microLog_ofs.open((logFile), std::fstream::app)
+			#define uLOG_INIT_MUTEX  boost::mutex logMutex;
 
 			#define MICRO_LOG_LOCK                                          \
-				;
+				{                                                           \
+					boost::lock_guard<boost::mutex> ulog_lock(uLog::logMutex);
 			#define MICRO_LOG_UNLOCK                                        \
-				;
+				}
 
-		// PThread library      //+TEST
+		// PThread library
 		#elif(MICRO_LOG_THREADING == MICRO_LOG_PTHREAD)
 
-			#define MICRO_LOG_INIT                                          \
-				MICRO_LOG_INIT_0;                                           \
-				pthread_mutex_t ulog_mutex;
+			extern pthread_mutex_t logMutex;
 
-			// Use this macro once in the main() function, before any log
-			#define MICRO_LOG_START(logFile)                                \
-				pthread_mutex_init(&ulog_mutex, NULL);                      \
-				microLog_ofs.open((logFile))
-			#define MICRO_LOG_START_APPEND(logFile)                         \
-				pthread_mutex_init(&ulog_mutex, NULL);                      \
-				microLog_ofs.open((logFile), std::fstream::app)
+			#define uLOG_INIT_MUTEX  pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
 
 			#define MICRO_LOG_LOCK                                          \
-				pthread_mutex_lock(&ulog_mutex)
+				{                                                           \
+					pthread_mutex_lock(&uLog::logMutex);
 			#define MICRO_LOG_UNLOCK                                        \
-				pthread_mutex_unlock(&ulog_mutex)
+					pthread_mutex_unlock(&uLog::logMutex);                  \
+				}
+
+		#endif
+
+		#define uLOG_INIT uLOG_INIT_0
+
+		// Multithreading, synchronous mode: group commit of the messages to microLog_ofs
+		#if(MICRO_LOG_THREADING != MICRO_LOG_SINGLE_THREAD) && !defined(MICRO_LOG_ASYNC) && !defined(MICRO_LOG_MMAP) && \
+		   !defined(MICRO_LOG_CLIENT) && defined(_POSIX_VERSION)
+			#define MICRO_LOG_GROUP_COMMIT
+		#endif
 
+		#ifdef MICRO_LOG_GROUP_COMMIT
+			#ifndef MICRO_LOG_GROUP_SIZE
+				#define MICRO_LOG_GROUP_SIZE 64       // max number of messages written at once
+			#endif
+
+			#define uLOG_INIT_GROUP_COMMIT                                                                 \
+				std::mutex GroupCommit::mutex;                                                             \
+				std::condition_variable GroupCommit::cond;                                                 \
+				GroupCommit::Group GroupCommit::groups[2];                                                 \
+				GroupCommit::Group *GroupCommit::filling = &GroupCommit::groups[0];                        \
+				unsigned long long GroupCommit::fillingSeq = 1, GroupCommit::writtenSeq = 0;               \
+				bool GroupCommit::leaderActive = false;                                                    \
+				int GroupCommit::fd = -1;                                                                  \
+				std::atomic<unsigned long> GroupCommit::nGroups(0), GroupCommit::nRecords(0);
+
+			#define uLOG_START_GROUP_COMMIT  uLog::GroupCommit::Open(uLog::logFilename);
+		#else
+			#define uLOG_INIT_GROUP_COMMIT
+			#define uLOG_START_GROUP_COMMIT
 		#endif
 
 
@@ -383,147 +1109,4926 @@ namespace uLog {
 			return os;
 		}
 
-		inline bool CheckLogLevel(int _level, int _localLevel = nolog)
-		{
-			#ifndef MICRO_LOG_DLL
-				Statistics::Update(_level);
-			#endif
+		#ifdef MICRO_LOG_SINKS
+		extern std::atomic<int> minSinkLevel;    // lowest minimum level of the sinks (nLogLevels: none)
+		#endif
 
-			if(loggerStatus != 0) {        // cannot log if status is not clean
-				if(_level > error)
-					std::cerr << "Error " << loggerStatus << ": logger disabled, and a critical error has been generated!" << std::endl;
-				return false;
-			}
+		#ifdef MICRO_LOG_RECORDER
+		extern std::atomic<int> minRecordLevel;  // lowest level kept by the flight recorder (nLogLevels: none)
+		#endif
 
-			if(_level < MICRO_LOG_MIN_LEVEL || _level < _localLevel)
-				return false;
+		#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+		extern std::atomic<int> lowestLevel;     // LowestLevel(), kept by UpdateThresholds()
+		#endif
 
-			if(_localLevel == nolog && _level < uLog::minLogLevel)
-				return false;
+		#if defined(MICRO_LOG_LEVELS) || defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+		inline void UpdateThresholds();
+		#endif
 
-			return true;
-		}
+		#if defined(__GNUC__)
+			#define uLOG_LIKELY(x)    __builtin_expect(!!(x), 1)
+			#define uLOG_UNLIKELY(x)  __builtin_expect(!!(x), 0)
+			#define uLOG_COLD         __attribute__((noinline, cold))
+		#elif defined(_MSC_VER)
+			#define uLOG_LIKELY(x)    (x)
+			#define uLOG_UNLIKELY(x)  (x)
+			#define uLOG_COLD         __declspec(noinline)
+		#else
+			#define uLOG_LIKELY(x)    (x)
+			#define uLOG_UNLIKELY(x)  (x)
+			#define uLOG_COLD
+		#endif
 
-		inline bool CheckAvailableSpace(const std::string &logfname)
-			// Check if the next log message can fit in the remaining available space
+		#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+		inline int LowestLevel()
+			// Lowest level wanted by microLog_ofs, the sinks or the flight recorder
 		{
-		#if(MICRO_LOG_BOOST == 1)
-			boost::system::error_code errCode;
-			boost::filesystem::space_info space = boost::filesystem::space(logfname, errCode);
-			if(space.available < maxLogSize) {
-				std::cerr << "Logger error: not enough space available in the current partition (" << space.available << " bytes)." << std::endl;
-				return false;
-			}
-		#endif
-			return true;
+			int level = minLogLevel.load(std::memory_order_relaxed);
+			#ifdef MICRO_LOG_SINKS
+			const int sinkLevel = minSinkLevel.load(std::memory_order_relaxed);
+			if(sinkLevel < level) level = sinkLevel;
+			#endif
+			#ifdef MICRO_LOG_RECORDER
+			const int recordLevel = minRecordLevel.load(std::memory_order_relaxed);
+			if(recordLevel < level) level = recordLevel;
+			#endif
+			return level;
 		}
+		#endif
 
-		inline bool CheckAvailableSpace()
-			// Check if the next log message can fit in the remaining available space
+		inline bool LevelEnabled(int _level, int _localLevel = nolog)
+			// The fast path of uLOG: a relaxed load and a compare (both folded at compile time
+			// for a constant local level); the rest of the checks are in CheckLogLevel().
+			// Note: the rejected messages are not in the statistics.
 		{
-			return CheckAvailableSpace(uLog::logFilename);
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			const int threshold = _localLevel != nolog ? _localLevel : lowestLevel.load(std::memory_order_relaxed);
+			#else
+			const int threshold = _localLevel != nolog ? _localLevel : minLogLevel.load(std::memory_order_relaxed);
+			#endif
+			return _level >= MICRO_LOG_MIN_LEVEL && _level >= threshold;
 		}
 
+		#ifdef MICRO_LOG_LEVELS
 
-		inline std::string LogTime() {
-			float t = float(std::clock())/CLOCKS_PER_SEC;
-			const size_t sz = 16;
-			char ct[sz];
-			std::snprintf(ct, sz, "% 7.3f  ", t);
-			return std::string(ct);
-		}
+		struct Levels
+			/// Minimum levels of modules (uLOGM tag), source files and functions, set at run time.
+			/// The most specific rule applies to a call site: function, then file, then module;
+			/// the rule level replaces uLog::minLogLevel (not the local level of uLOG_), also for
+			/// the sinks. Each call site caches its rule, with the generation of the rules it was
+			/// resolved at: a change bumps the generation, and each call site resolves its rule
+			/// again at its next message.
+			/// The rules are immutable once published: each change copies them and swaps a
+			/// pointer, so the call sites resolve their rule without locks; the previous ones are
+			/// freed at exit.
+			/// Files match by suffix of __FILE__ ("net/socket.cpp"); functions by name, or by a
+			/// part of the signature if they contain "::" ("Socket::" for all its methods).
+		{
+			enum Kind { module, file, function };
 
-		inline std::string LogDate() {
-			std::time_t t = std::time(nullptr);
-			char mbstr[32];
-			std::strftime(mbstr, sizeof(mbstr), "%F %T  ", std::localtime(&t));
-			return std::string(mbstr);
-		}
+			struct Rule {
+				Kind        kind;
+				std::string pattern;
+				int         level;
+			};
 
-		inline std::string GetPID() {
-			#ifdef _POSIX_VERSION
-				return std::to_string(getpid());
-			#elif defined WIN32
-				return std::to_string(_getpid());
-			#else
-				return "?";
-			#endif
-		}
+			struct Site
+				/// Call site cache: (generation << 8) | (rule level + 1), 0 if not resolved
+			{
+				const char                     *module, *file;
+				std::atomic<unsigned long long> cache;
 
-		inline std::string GetUID() {
-			#ifdef _POSIX_VERSION
-				return std::to_string(getuid());
-			#elif defined WIN32
-				return "?";
-			#else
-				return "?";
-			#endif
-		}
+				constexpr Site(const char *_module, const char *_file) : module(_module), file(_file), cache(0) {}
+			};
 
-		inline std::string GetUserName() {
-			#ifdef _POSIX_VERSION
-				return getlogin();
+			static const int none = -1;                     // no rule
+
+			typedef std::vector<Rule> Rules;
+
+			static std::atomic<unsigned long long> generation;
+			static std::atomic<int>                minLevel;       // lowest level of the rules (nLogLevels: none)
+			static std::atomic<int>                threshold;      // lowest of minLevel and LowestLevel()
+			static std::atomic<const Rules*>       rules;          // current rules (nullptr: none)
+			static std::vector<const Rules*>       retired;        // previous ones (under mutex)
+			static std::mutex                      mutex;          // changes of the rules
+
+			static void SetModule(const std::string &tag, int level)    { Set(module, tag, level); }
+			static void SetFile(const std::string &path, int level)     { Set(file, path, level); }
+			static void SetFunction(const std::string &name, int level) { Set(function, name, level); }
+
+			static void Set(Kind kind, const std::string &pattern, int level)
+				// Add or change a rule; level none removes it
+			{
+				const Rule r = { kind, pattern, level };
+				Replace(Rules(), Rules(1, r));
+			}
+
+			static void Replace(const Rules &removed, const Rules &added)
+				// Remove some rules and add or change others, as a single change
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				const Rules *prev = rules.load(std::memory_order_relaxed);
+				Rules *next = prev ? new Rules(*prev) : new Rules;
+				for(size_t i = 0; i < removed.size(); ++i)
+					Apply(*next, removed[i].kind, removed[i].pattern, none);
+				for(size_t i = 0; i < added.size(); ++i)
+					Apply(*next, added[i].kind, added[i].pattern, added[i].level);
+				Publish(next, prev);
+			}
+
+			static void Clear()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				Publish(nullptr, rules.load(std::memory_order_relaxed));
+			}
+
+			static bool Possible(int level, int localMinLevel)
+				// Before Threshold(): false if neither the global levels nor any rule can enable
+				// the message, so the rejected messages skip the call site cache
+			{
+				const int t = threshold.load(std::memory_order_relaxed);
+				return localMinLevel != nolog || (level >= MICRO_LOG_MIN_LEVEL && level >= t);
+			}
+
+			static int Threshold(Site &site, int localMinLevel, const char *func, const char *funcSig)
+				// Local level of a call site for LevelEnabled(): localMinLevel, if set, or its rule's
+				// level (nolog: none); two loads and a compare, when the cache is valid
+			{
+				if(localMinLevel != nolog)
+					return localMinLevel;
+				const unsigned long long g = generation.load(std::memory_order_relaxed);
+				const unsigned long long c = site.cache.load(std::memory_order_relaxed);
+				if(uLOG_LIKELY((c >> 8) == g))
+					return int(c & 0xff);
+				return Resolve(site, g, func, funcSig);
+			}
+
+		private:
+			static void Apply(Rules &r, Kind kind, const std::string &pattern, int level)
+			{
+				size_t i = 0;
+				while(i < r.size() && !(r[i].kind == kind && r[i].pattern == pattern))
+					++i;
+				if(level == none) {
+					if(i < r.size())
+						r.erase(r.begin() + std::ptrdiff_t(i));
+				}
+				else if(i < r.size())
+					r[i].level = level;
+				else {
+					const Rule rule = { kind, pattern, level };
+					r.push_back(rule);
+				}
+			}
+
+			static void Publish(const Rules *next, const Rules *prev)
+				// Under mutex: the readers of prev may still use it, so it is freed at exit
+			{
+				int m = nLogLevels;
+				for(size_t i = 0; next && i < next->size(); ++i)
+					if((*next)[i].level < m)
+						m = (*next)[i].level;
+				rules.store(next, std::memory_order_release);
+				minLevel = m;
+				UpdateThresholds();
+				generation.fetch_add(1, std::memory_order_release);
+				if(prev) {
+					static bool atExitSet = false;
+					if(!atExitSet) {
+						std::atexit(&Levels::Exit);
+						atExitSet = true;
+					}
+					retired.push_back(prev);
+				}
+			}
+
+			static void Exit()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for(size_t i = 0; i < retired.size(); ++i)
+					delete retired[i];
+				retired.clear();
+			}
+
+			static bool EndsWith(const char *s, const std::string &suffix) {
+				const size_t len = std::strlen(s);
+				return len >= suffix.size() && suffix.compare(0, suffix.size(), s + len - suffix.size()) == 0;
+			}
+
+			uLOG_COLD static int Resolve(Site &site, unsigned long long g, const char *func, const char *funcSig)
+			{
+				int level = none, rank = -1;
+				g = generation.load(std::memory_order_acquire);          // then its rules, or newer ones
+				const Rules *current = rules.load(std::memory_order_acquire);
+				for(size_t i = 0; current && i < current->size(); ++i) {
+					const Rule &r = (*current)[i];
+					bool match = false;
+					switch(r.kind) {
+					case module:   match = site.module && r.pattern == site.module; break;
+					case file:     match = EndsWith(site.file, r.pattern); break;
+					case function: match = r.pattern == func ||
+					                       (r.pattern.find("::") != std::string::npos && std::strstr(funcSig, r.pattern.c_str()));
+					               break;
+					}
+					if(match && int(r.kind) > rank) {
+						level = r.level;
+						rank = int(r.kind);
+					}
+				}
+
+				// As a local level: nolog is no level, so a rule for all the messages is verbose
+				const int local = level == none ? nolog : (level > verbose ? level : int(verbose));
+				site.cache.store((g << 8) | (unsigned long long)local, std::memory_order_relaxed);
+				return local;
+			}
+		};
+
+		#endif // MICRO_LOG_LEVELS
+
+		#if defined(MICRO_LOG_LEVELS) || defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+
+		inline void UpdateThresholds()
+			// After a change of minLogLevel, of a sink level, of the recorder level or of the
+			// Levels rules: the single loads of LevelEnabled() and Levels::Possible()
+		{
+			static std::mutex mutex;                 // the last update sees all the changes
+			std::lock_guard<std::mutex> lock(mutex);
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			const int lowest = LowestLevel();
+			lowestLevel.store(lowest, std::memory_order_relaxed);
+			#else
+			const int lowest = minLogLevel.load(std::memory_order_relaxed);
+			#endif
+			#ifdef MICRO_LOG_LEVELS
+			const int rules = Levels::minLevel.load(std::memory_order_relaxed);
+			Levels::threshold.store(rules < lowest ? rules : lowest, std::memory_order_relaxed);
+			#else
+			(void)lowest;
+			#endif
+		}
+
+		inline void GlobalLevel::store(int level, std::memory_order order)
+		{
+			value.store(level, order);
+			UpdateThresholds();
+		}
+
+		#endif
+
+		uLOG_COLD inline bool CheckLogLevel(int _level, int _localLevel = nolog)
+			// Out of line, only for the messages passing LevelEnabled()
+		{
+			#ifndef MICRO_LOG_DLL
+				Statistics::Update(_level);
+			#endif
+
+			if(loggerStatus != 0) {        // cannot log if status is not clean
+				if(_level > error)
+					std::cerr << "Error " << loggerStatus << ": logger disabled, and a critical error has been generated!" << std::endl;
+				return false;
+			}
+
+			if(_level < MICRO_LOG_MIN_LEVEL || _level < _localLevel)
+				return false;
+
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			if(_localLevel == nolog && _level < LowestLevel())
+				return false;         // wanted neither by microLog_ofs nor by any sink or the recorder
+			#else
+			if(_localLevel == nolog && _level < uLog::minLogLevel)
+				return false;
+			#endif
+
+			return true;
+		}
+
+		inline unsigned long long AvailableSpace(const std::string &logfname)
+			// Space available in the partition of the log file (bytes)
+		{
+		#if(MICRO_LOG_BOOST == 1)
+			boost::system::error_code errCode;
+			boost::filesystem::space_info space = boost::filesystem::space(logfname, errCode);
+			return space.available;
+		#else
+			return ~0ULL;
+		#endif
+		}
+
+		inline bool EnoughSpace(unsigned long long available)
+			// Check if the next log message can fit in available bytes
+		{
+			if(available < maxLogSize) {
+				std::cerr << "Logger error: not enough space available in the current partition (" << available << " bytes)." << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+		inline bool CheckAvailableSpace(const std::string &logfname)
+			// Check if the next log message can fit in the remaining available space
+		{
+			return EnoughSpace(AvailableSpace(logfname));
+		}
+
+		inline bool CheckAvailableSpace()
+			// Check if the next log message can fit in the remaining available space
+		{
+			return CheckAvailableSpace(uLog::logFilename);
+		}
+
+		#ifdef MICRO_LOG_TIERING
+
+		struct Tiering
+			/// Ramdisk tiering: the log file stays on a fast (e.g. tmpfs) partition, and a
+			/// background thread appends its complete records to path + log file name, in large
+			/// chunks copied by the kernel (copy_file_range, sendfile). It drains every interval
+			/// seconds and when the free space falls below lowWatermark; then it also releases
+			/// (punches holes in) the part of the log file already copied. The progress is stored
+			/// in a .drain file next to the copy, so uLOG_START completes the copy after a crash.
+			/// Set it before uLOG_START.
+		{
+			static std::string        path;            // durable directory, as backupPath (empty: disabled)
+			static long               interval;        // drain every interval seconds (0: on low space only)
+			static unsigned long long lowWatermark;    // drain and free the log file below this free space
+
+			static std::atomic<unsigned long long> committed;   // end of the complete records in the log file
+			static unsigned long long              pending;     // written to microLog_ofs, not flushed (under the lock)
+
+			static unsigned long long drained, durableLen, punched;    // drain thread only
+			static int                hotFd, durableFd, stateFd;
+			static bool               copyRange;
+
+			static std::atomic<unsigned long long> nBytes, nFreed;
+			static std::atomic<unsigned long>      nDrains, nErrors;
+			static std::atomic<bool>               lowSpace;
+
+			static std::mutex              mutex;
+			static std::condition_variable cond;
+			static bool                    stop, wake;
+			static std::thread             worker;
+
+			static void Set(const std::string &_path, long _interval = 60, unsigned long long _lowWatermark = 0) {
+				path = _path; interval = _interval; lowWatermark = _lowWatermark;
+			}
+
+			static std::string DurableName() {
+				return path + (logFilename.c_str() + BaseNameOffset(logFilename.c_str()));
+			}
+
+			static void Written(size_t len) { pending += len; }      // by microLog_ofs (caller holds the lock)
+			static void Flushed() {                                  // microLog_ofs flushed (caller holds the lock)
+				committed.fetch_add(pending, std::memory_order_release);
+				pending = 0;
+			}
+			static void Synced(size_t len) {                         // written with a system call
+				committed.fetch_add(len, std::memory_order_release);
+			}
+
+			static void LowSpace(unsigned long long available)
+				// Called by SpaceGuard with the space left in the partition
+			{
+				if(available < lowWatermark && !lowSpace.exchange(true, std::memory_order_relaxed))
+					Wake();
+			}
+
+			static void Wake() {
+				std::lock_guard<std::mutex> lock(mutex);
+				wake = true;
+				cond.notify_one();
+			}
+
+			static unsigned long long Committed(bool all = false);
+
+			static void Recover()
+				// Called by uLOG_START, before the backup of the previous log: copies what a
+				// previous run did not drain
+			{
+				Stop(false);
+				static bool atExitSet = false;      // first registered: runs after the writers stopped
+				if(!atExitSet) {
+					std::atexit(&Tiering::Exit);
+					atExitSet = true;
+				}
+				if(path.empty() || !Open())
+					return;
+				Drain(Committed(true));
+				Close();
+			}
+
+			static void Start()
+				// Called by uLOG_START, after opening the log file
+			{
+				Stop(false);
+				if(path.empty())
+					return;
+				if(!Open()) {
+					std::cerr << "Logger error: cannot open " << DurableName() << ", the log file is not drained." << std::endl;
+					nErrors.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				struct stat st;
+				committed = fstat(hotFd, &st) == 0 ? (unsigned long long)st.st_size : drained;
+				pending = 0;
+				stop = wake = false;
+				worker = std::thread(&Tiering::Work);
+			}
+
+			static void Stop(bool all)
+				// Drain the complete records, or all the log file (no writers active), and stop
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stop = true;
+					cond.notify_all();
+				}
+				if(worker.joinable())
+					worker.join();
+				if(hotFd < 0)
+					return;
+				Drain(Committed(all));
+				Close();
+			}
+
+			static void Exit() { Stop(true); }
+
+		private:
+			static bool Open()
+				// The log file, its copy, and the progress of the previous drains
+			{
+				Close();
+				struct stat st;
+				if(stat(logFilename.c_str(), &st) != 0)
+					return false;
+				hotFd = open(logFilename.c_str(), O_RDWR);
+				durableFd = open(DurableName().c_str(), O_WRONLY | O_CREAT, 0644);
+				stateFd = open((DurableName() + ".drain").c_str(), O_RDWR | O_CREAT, 0644);
+				if(hotFd < 0 || durableFd < 0 || stateFd < 0) {
+					Close();
+					return false;
+				}
+
+				char state[80] = {};
+				unsigned long long dev = 0, ino = 0, hotOffset = 0, length = 0;
+				const off_t durableSize = lseek(durableFd, 0, SEEK_END);
+				if(pread(stateFd, state, sizeof(state) - 1, 0) > 0 &&
+				   std::sscanf(state, "%llu %llu %llu %llu", &dev, &ino, &hotOffset, &length) == 4 &&
+				   dev == (unsigned long long)st.st_dev && ino == (unsigned long long)st.st_ino &&
+				   hotOffset <= (unsigned long long)st.st_size && length <= (unsigned long long)durableSize) {
+					drained = hotOffset;           // the same log file: go on from there
+					durableLen = length;           // bytes copied after the last update are copied again
+					if(ftruncate(durableFd, off_t(length))) {}
+				}
+				else {
+					drained = 0;
+					durableLen = (unsigned long long)durableSize;
+				}
+				punched = 0;
+				return true;
+			}
+
+			static void Close()
+			{
+				if(hotFd >= 0)     close(hotFd);
+				if(durableFd >= 0) close(durableFd);
+				if(stateFd >= 0)   close(stateFd);
+				hotFd = durableFd = stateFd = -1;
+			}
+
+			static void Drain(unsigned long long end)
+				// Copy the log file up to end, then update the progress
+			{
+				const unsigned long long start = drained;
+				off_t in = off_t(drained), out = off_t(durableLen);
+				while((unsigned long long)in < end) {
+					const size_t n = end - in < MICRO_LOG_TIERING_CHUNK ? size_t(end - in) : MICRO_LOG_TIERING_CHUNK;
+					ssize_t copied = -1;
+					#ifdef __linux__
+					if(copyRange) {
+						copied = copy_file_range(hotFd, &in, durableFd, &out, n, 0);
+						if(copied < 0 && errno != EINTR && errno != EIO && errno != ENOSPC)
+							copyRange = false;     // e.g. across file systems: use sendfile
+					}
+					if(!copyRange && lseek(durableFd, out, SEEK_SET) == out) {
+						copied = sendfile(durableFd, hotFd, &in, n);
+						if(copied > 0)
+							out += copied;
+					}
+					#else
+					char buf[1 << 16];
+					copied = pread(hotFd, buf, n < sizeof(buf) ? n : sizeof(buf), in);
+					if(copied > 0 && pwrite(durableFd, buf, size_t(copied), out) != copied)
+						copied = -1;
+					if(copied > 0) {
+						in += copied;
+						out += copied;
+					}
+					#endif
+					if(copied < 0 && errno == EINTR)
+						continue;
+					if(copied <= 0) {
+						if(copied < 0)
+							nErrors.fetch_add(1, std::memory_order_relaxed);
+						break;
+					}
+				}
+				if((unsigned long long)in == start)
+					return;
+
+				if(fdatasync(durableFd) != 0)
+					nErrors.fetch_add(1, std::memory_order_relaxed);
+				drained = (unsigned long long)in;
+				durableLen = (unsigned long long)out;
+				nBytes.fetch_add(drained - start, std::memory_order_relaxed);
+				nDrains.fetch_add(1, std::memory_order_relaxed);
+
+				struct stat st;
+				char state[80];
+				std::memset(state, ' ', sizeof(state));
+				if(fstat(hotFd, &st) == 0) {
+					const int len = std::snprintf(state, sizeof(state), "%llu %llu %llu %llu", (unsigned long long)st.st_dev,
+					                              (unsigned long long)st.st_ino, drained, durableLen);
+					state[len] = ' ';
+					state[sizeof(state) - 1] = '\n';
+					if(pwrite(stateFd, state, sizeof(state), 0) != ssize_t(sizeof(state)))
+						nErrors.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+
+			static void Free()
+				// Release the pages of the log file already copied
+			{
+				#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+				const unsigned long long page = (unsigned long long)sysconf(_SC_PAGESIZE);
+				const unsigned long long end = drained / page * page;
+				if(end > punched && fallocate(hotFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off_t(punched), off_t(end - punched)) == 0) {
+					nFreed.fetch_add(end - punched, std::memory_order_relaxed);
+					punched = end;
+				}
+				#endif
+			}
+
+			static void Work()
+			{
+				typedef std::chrono::steady_clock Clock;
+				Clock::time_point next = Clock::now() + std::chrono::seconds(interval);
+				std::unique_lock<std::mutex> lock(mutex);
+				while(!stop) {
+					cond.wait_for(lock, std::chrono::seconds(1));     // checks the space every second
+					if(stop)
+						break;
+					const bool woken = wake;
+					wake = false;
+					lock.unlock();
+
+					const bool low = lowSpace.exchange(false, std::memory_order_relaxed) ||
+					                 (lowWatermark && AvailableSpace(logFilename) < lowWatermark);
+					const bool due = interval > 0 && Clock::now() >= next;
+					if(woken || low || due) {
+						Drain(Committed());
+						if(low)
+							Free();
+						next = Clock::now() + std::chrono::seconds(interval);
+					}
+					lock.lock();
+				}
+			}
+		};
+
+		#endif // MICRO_LOG_TIERING
+
+		class SpaceGuard
+			/// Available space check amortized over many messages: a byte budget is refreshed
+			/// with AvailableSpace() at most every checkInterval bytes; in between, each
+			/// message only subtracts its length from it.
+		{
+		public:
+			explicit SpaceGuard(const std::string &_logfname, long long _checkInterval = MICRO_LOG_SPACE_CHECK_INTERVAL)
+				: logfname(_logfname), checkInterval(_checkInterval), budget(0), refreshing(false), spaceOk(true) {}
+
+			bool Consume(size_t len) {
+				// Check if a message of len bytes can be written, and account for it
+				if(budget.fetch_sub((long long)len, std::memory_order_relaxed) >= (long long)len)
+					return true;
+				return Refresh(len);
+			}
+
+			void Reset() {
+				// Check again before the next message (e.g. the log file changed)
+				budget.store(0, std::memory_order_relaxed);
+			}
+
+		private:
+			bool Refresh(size_t len)
+			{
+				if(refreshing.exchange(true, std::memory_order_acquire))
+					return spaceOk.load(std::memory_order_relaxed);     // another thread is checking
+
+				const unsigned long long space = AvailableSpace(logfname);      // a single statfs
+				const bool ok = EnoughSpace(space);
+				const unsigned long long available = space > maxLogSize ? space - maxLogSize : 0;
+				long long newBudget = 0;
+				if(ok) {
+					newBudget = available < (unsigned long long)checkInterval ? (long long)available : checkInterval;
+					newBudget -= (long long)len;
+				}
+				#ifdef MICRO_LOG_TIERING
+				Tiering::LowSpace(available);
+				#endif
+				budget.store(newBudget, std::memory_order_relaxed);
+				spaceOk.store(ok, std::memory_order_relaxed);
+
+				refreshing.store(false, std::memory_order_release);
+				return ok;
+			}
+
+			const std::string      &logfname;
+			const long long         checkInterval;
+			std::atomic<long long>  budget;          // bytes that can be written before the next check
+			std::atomic<bool>       refreshing, spaceOk;
+		};
+
+		extern SpaceGuard spaceGuard;                // checks the space for microLog_ofs
+
+
+		struct Timestamp
+			/// Wall clock time of the log messages, read from a monotonic clock anchored to the
+			/// system clock (see Anchor()). Date and time are formatted once per second in a
+			/// per thread cache; each message only adds the sub-second digits.
+		{
+			static const size_t maxLen = 32;     // max length of a formatted date/time (bytes)
+
+			static int& Precision() {            // sub-second digits: 0, 3 (ms), 6 (us), 9 (ns)
+				static int precision = MICRO_LOG_TIME_PRECISION;
+				return precision;
+			}
+
+			struct Clock {
+				long long                             wallNs;     // system clock at anchoring (ns since epoch)
+				std::chrono::steady_clock::time_point steady;     // monotonic clock at anchoring
+
+				Clock() { Set(); }
+
+				void Set() {
+					steady = std::chrono::steady_clock::now();
+					wallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					             std::chrono::system_clock::now().time_since_epoch()).count();
+				}
+			};
+
+			static Clock& Origin() {             // anchoring, also without uLOG_INIT (uLOGF)
+				static Clock anchor;
+				return anchor;
+			}
+
+			static void Anchor() {
+				// Resynchronize with the system clock (called by uLOG_START)
+				Origin().Set();
+			}
+
+			static long long Now() {
+				// Wall clock time (ns since epoch)
+				const Clock &anchor = Origin();
+				return anchor.wallNs + std::chrono::duration_cast<std::chrono::nanoseconds>(
+				                           std::chrono::steady_clock::now() - anchor.steady).count();
+			}
+
+			static long long Elapsed(long long ns) {
+				// Time since anchoring (ns)
+				return ns - Origin().wallNs;
+			}
+
+			static size_t FormatDate(char *dst, long long ns)
+				// "YYYY-MM-DD HH:MM:SS[.sss...]  "; dst must hold maxLen bytes
+			{
+				struct Cache {
+					bool      valid;
+					long long sec;
+					char      text[20];
+				};
+				static thread_local Cache cache;
+
+				const long long sec = ns / 1000000000, subSec = ns % 1000000000;
+
+				if(!cache.valid || cache.sec != sec) {
+					std::time_t t = std::time_t(sec);
+					std::tm tm;
+					#ifdef WIN32
+						localtime_s(&tm, &t);
+					#else
+						localtime_r(&t, &tm);
+					#endif
+					std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &tm);
+					cache.sec = sec;
+					cache.valid = true;
+				}
+
+				std::memcpy(dst, cache.text, 19);
+				size_t len = 19;
+
+				const int precision = Precision();
+				if(precision > 0) {
+					const int digits = precision > 9 ? 9 : precision;
+					long long v = subSec;
+					for(int i = digits; i < 9; ++i) v /= 10;
+					dst[len++] = '.';
+					for(int i = digits - 1; i >= 0; --i, v /= 10)
+						dst[len + i] = char('0' + v % 10);
+					len += digits;
+				}
+
+				dst[len++] = ' ';
+				dst[len++] = ' ';
+				return len;
+			}
+
+			static size_t FormatElapsed(char *dst, long long ns)
+				// Seconds since anchoring, as "% 7.3f  "; dst must hold maxLen bytes
+			{
+				long long ms = Elapsed(ns) / 1000000;
+				if(ms < 0) ms = 0;
+				char tmp[maxLen];
+				char *p = tmp + sizeof(tmp);
+				for(int i = 0; i < 3; ++i, ms /= 10) *--p = char('0' + ms % 10);
+				*--p = '.';
+				do { *--p = char('0' + ms % 10); ms /= 10; } while(ms);
+				*--p = ' ';
+				while(tmp + sizeof(tmp) - p < 7) *--p = ' ';
+				size_t len = size_t(tmp + sizeof(tmp) - p);
+				std::memcpy(dst, p, len);
+				dst[len++] = ' ';
+				dst[len++] = ' ';
+				return len;
+			}
+
+			static const char* DateTitle() {
+				static const char titles[4][maxLen] = { "Date                 ", "Date                     ",
+				                                         "Date                        ", "Date                           " };
+				const int precision = Precision();
+				return titles[precision <= 0 ? 0 : precision <= 3 ? 1 : precision <= 6 ? 2 : 3];
+			}
+		};
+
+		inline std::string LogTime() {
+			char ct[Timestamp::maxLen];
+			return std::string(ct, Timestamp::FormatElapsed(ct, Timestamp::Now()));
+		}
+
+		inline std::string LogDate() {
+			char mbstr[Timestamp::maxLen];
+			return std::string(mbstr, Timestamp::FormatDate(mbstr, Timestamp::Now()));
+		}
+
+		inline long ProcessID() {
+			#ifdef _POSIX_VERSION
+				return long(getpid());
+			#elif defined WIN32
+				return long(_getpid());
+			#else
+				return -1;
+			#endif
+		}
+
+		inline long UserID() {
+			#ifdef _POSIX_VERSION
+				return long(getuid());
+			#else
+				return -1;
+			#endif
+		}
+
+		inline const char* UserName() {
+			#ifdef _POSIX_VERSION
+				const char *login = getlogin();      // null when there is no controlling terminal
+				return login ? login : "?";
 			#elif defined WIN32
-				GetUserName(username, UNLEN+1);
-				return username;
+				DWORD sz = UNLEN+1;
+				return ::GetUserNameA(username, &sz) ? username : "?";
+			#else
+				return "?";
+			#endif
+		}
+
+		inline std::string GetPID() {
+			return ProcessID() < 0 ? "?" : std::to_string(ProcessID());
+		}
+
+		inline std::string GetUID() {
+			return UserID() < 0 ? "?" : std::to_string(UserID());
+		}
+
+		inline std::string GetUserName() {
+			return UserName();
+		}
+
+
+		struct ProcessFields
+			/// Fields constant for the whole process: formatted once (by uLOG_START, or by the
+			/// first message) with their separator, and copied as they are in each message.
+			/// The PID is formatted again in the child process after a fork().
+		{
+			struct Field {
+				char   text[128];
+				size_t len;
+
+				void Set(const char *s) {
+					len = 0;
+					for(; *s && len < sizeof(text) - sizeof(separator); ++s) text[len++] = *s;
+					for(const char *sep = separator; *sep; ++sep) text[len++] = *sep;
+				}
+
+				void Set(long v) {
+					char tmp[24];
+					char *p = tmp + sizeof(tmp);
+					*--p = '\0';
+					if(v < 0) *--p = '?';
+					else do { *--p = char('0' + v % 10); v /= 10; } while(v);
+					Set(p);
+				}
+			};
+
+			static Field exec, pid, uid, uname;
+			static std::atomic<bool> ready;
+
+			static void Update()
+			{
+				exec.Set(MICRO_LOG_EXECUTABLE_NAME);
+				pid.Set(ProcessID());
+				uid.Set(UserID());
+				uname.Set(UserName());
+
+				#ifdef _POSIX_VERSION
+				static bool atForkSet = false;
+				if(!atForkSet) {
+					pthread_atfork(nullptr, nullptr, &ProcessFields::UpdateChild);
+					atForkSet = true;
+				}
+				#endif
+
+				ready.store(true, std::memory_order_release);
+			}
+
+			static void UpdateChild() {
+				// Only async-signal-safe calls here: the parent may be multithreaded
+				pid.Set(ProcessID());
+			}
+
+			static void Check() {
+				if(!ready.load(std::memory_order_acquire))
+					Update();
+			}
+		};
+
+
+		struct BinaryLog
+			/// Binary log format (MICRO_LOG_BINARY), converted to text by microLog_decode.
+			/// The file is a sequence of records: type (1 byte), payload length (2 bytes), payload.
+			/// Numbers are in the byte order of the logging machine; strings are length (2 bytes) + bytes.
+			///   header:   magic, version (1), byte order mark (2), anchor time (8, ns), separator,
+			///             process fields as in the text format: exec, pid, uid, user name
+			///   site:     site id (4), line (4), file path, function, function signature
+			///   message:  site id (4), level (1), date precision (1), fields mask (2), time (8, ns),
+			///             arguments: type tag (1) + value
+			///   text:     level (1), text       (messages without fields, e.g. uLOG_TITLES)
+		{
+			static const char header = 'H', site = 'S', message = 'M', text = 'T';     // record types
+
+			static const char argSigned = 'i', argUnsigned = 'u', argDouble = 'd',      // argument tags
+			                  argChar = 'c', argBool = 'b', argString = 's';
+
+			static const unsigned char  version = 1;
+			static const unsigned short byteOrder = 0x0102;
+
+			static const size_t recordHead = 3;                  // type + payload length
+			static const size_t textHead = recordHead + 1;
+			static const size_t messageHead = recordHead + 16;
+
+			static const char* Magic() { return "uLOG"; }
+
+			template <typename T>
+			static char* Put(char *p, T v) {
+				std::memcpy(p, &v, sizeof(v));
+				return p + sizeof(v);
+			}
+
+			template <typename T>
+			static const char* Get(const char *p, T &v) {
+				std::memcpy(&v, p, sizeof(v));
+				return p + sizeof(v);
+			}
+
+			static char* PutString(char *p, const char *s, size_t maxLen) {
+				size_t len = s ? std::strlen(s) : 0;
+				if(len > maxLen) len = maxLen;
+				p = Put(p, (unsigned short)len);
+				std::memcpy(p, s, len);
+				return p + len;
+			}
+
+			static void SetLength(char *record, size_t len) {
+				// Payload length of a complete record of len bytes
+				Put(record + 1, (unsigned short)(len - recordHead));
+			}
+		};
+
+
+		struct Record
+			/// Log message under construction, in a fixed size buffer of its thread's
+			/// RecordStack, written to its stream at once by uLOGE. No heap allocations.
+		{
+			char          data[maxLogSize];
+			size_t        len;
+			int           level;
+			bool          formatted;     // format flags changed by a manipulator (e.g. std::hex)
+			bool          framed;        // binary mode: a BinaryLog record to microLog_ofs
+			bool          binary;        // binary mode: a BinaryLog message, with raw arguments
+			std::ostream *target;
+			long long     start;         // Statistics::Clock() at the start of the message (0: not measured)
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			bool          toTarget;      // wanted by target, besides the sinks or the recorder
+			#endif
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_COALESCE)
+			size_t        body;          // start of the message, after the fields
+			#endif
+			#ifdef MICRO_LOG_SINKS
+			unsigned      fields;        // fields of the prefix (none if body is 0)
+			long long     time;
+			const char   *file, *fileName, *func, *funcSig, *line;
+			#endif
+			#ifdef MICRO_LOG_COALESCE
+			unsigned long long site;     // uLOG call site (0: not coalesced)
+			#endif
+			#ifdef MICRO_LOG_STRUCTURED
+			size_t        text;          // start of the message text, still to be closed (0: none)
+			size_t        kvLen;
+			char          kv[MICRO_LOG_KV_SIZE];     // key-values, written after the text
+			#endif
+
+			size_t Room() const {        // a byte is kept for the final new line
+				return maxLogSize - 1 - len;
+			}
+
+			void Append(const char *s, size_t n) {
+				if(n > Room()) n = Room();
+				std::memcpy(data + len, s, n);
+				len += n;
+			}
+
+			void Append(const char *s) {
+				if(s) Append(s, std::strlen(s));
+			}
+
+			void Put(char c) {
+				if(len < maxLogSize - 1) data[len++] = c;
+			}
+
+			void AppendUnsigned(unsigned long long v, bool negative = false) {
+				char tmp[24];
+				char *p = tmp + sizeof(tmp);
+				do { *--p = char('0' + v % 10); v /= 10; } while(v);
+				if(negative) *--p = '-';
+				Append(p, size_t(tmp + sizeof(tmp) - p));
+			}
+
+			void AppendSigned(long long v) {
+				AppendUnsigned(v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v, v < 0);
+			}
+
+			template <typename T>
+			Record& PutArg(char tag, T v) {
+				// Binary mode: a raw argument, dropped if it does not fit
+				if(1 + sizeof(v) <= Room()) {
+					data[len++] = tag;
+					len = size_t(BinaryLog::Put(data + len, v) - data);
+				}
+				return *this;
+			}
+
+			Record& PutArg(const char *s, size_t n) {
+				// Binary mode: a string argument, truncated if it does not fit
+				if(Room() >= 3) {
+					if(n > Room() - 3) n = Room() - 3;
+					data[len++] = BinaryLog::argString;
+					len = size_t(BinaryLog::Put(data + len, (unsigned short)n) - data);
+					Append(s, n);
+				}
+				return *this;
+			}
+
+			size_t BeginStringArg() {
+				// Binary mode: a string argument formatted in place; 0 if there is no room
+				if(Room() < 3) return 0;
+				data[len++] = BinaryLog::argString;
+				len += 2;
+				return len;
+			}
+
+			void EndStringArg(size_t start) {
+				BinaryLog::Put(data + start - 2, (unsigned short)(len - start));
+			}
+		};
+
+		struct RecordStack
+			/// The records of a thread: a message logged while another one is formatted (by a
+			/// function called in its arguments) takes the next record, so that the first one
+			/// is written whole after it. Beyond MICRO_LOG_RECORD_DEPTH the deepest messages
+			/// share the last record.
+		{
+			Record   records[MICRO_LOG_RECORD_DEPTH];
+			unsigned depth;              // messages begun and not yet ended
+
+			Record& Top() {
+				return records[depth == 0 ? 0 : depth < MICRO_LOG_RECORD_DEPTH ? depth - 1 : MICRO_LOG_RECORD_DEPTH - 1];
+			}
+		};
+
+		inline RecordStack& Records() {
+			static thread_local RecordStack stack;
+			return stack;
+		}
+
+		inline Record& ThisRecord() {
+			// The innermost message being formatted by the thread
+			return Records().Top();
+		}
+
+		inline Record& PushRecord() {
+			RecordStack &s = Records();
+			++s.depth;
+			return s.Top();
+		}
+
+		inline void EndRecord() {
+			// The message is written (uLOGE): its record is free
+			RecordStack &s = Records();
+			if(s.depth) --s.depth;
+		}
+
+		class RecordBuf : public std::streambuf
+			/// Lets std::ostream format into the current thread's record, for the types
+			/// and manipulators not directly handled by Record
+		{
+		protected:
+			int_type overflow(int_type c) {
+				if(!traits_type::eq_int_type(c, traits_type::eof()))
+					ThisRecord().Put(traits_type::to_char_type(c));
+				return traits_type::not_eof(c);
+			}
+
+			std::streamsize xsputn(const char *s, std::streamsize n) {
+				ThisRecord().Append(s, size_t(n));
+				return n;
+			}
+		};
+
+		inline std::ostream& FormatStream() {
+			static thread_local RecordBuf buf;
+			static thread_local std::ostream os(&buf);
+			return os;
+		}
+
+		inline void Commit(Record &r);
+
+		struct FlushPolicy
+			/// When the messages written to microLog_ofs are flushed to the file.
+			/// Set it before uLOG_START; by default every message is flushed.
+			/// Note: without the asynchronous writer thread, the interval is only checked
+			///       when a message is written.
+		{
+			static int    level;         // flush at each message of at least this level (nolog: always)
+			static size_t bytes;         // flush when at least these bytes are pending (0: no limit)
+			static size_t records;       // flush when at least these messages are pending (0: no limit)
+			static long   interval;      // flush the pending messages at least every interval ms (0: no limit)
+			static bool   atExit;        // flush at exit and at each fatal message
+
+			static size_t    pendingBytes, pendingRecords;
+			static long long lastFlush;
+
+			static unsigned long nFlushes, nLevelFlushes, nSizeFlushes, nTimeFlushes, nExitFlushes;
+
+			static void SetAlways() {
+				Set(nolog, 0, 0, 0, true);
+			}
+
+			static void SetLevel(int _level, long _interval = 1000) {
+				Set(_level, 0, 0, _interval, true);
+			}
+
+			static void SetBatch(size_t _bytes, size_t _records = 0, int _level = error, long _interval = 1000) {
+				Set(_level, _bytes, _records, _interval, true);
+			}
+
+			static void Set(int _level, size_t _bytes, size_t _records, long _interval, bool _atExit) {
+				level = _level; bytes = _bytes; records = _records; interval = _interval; atExit = _atExit;
+			}
+
+			static bool Always() {
+				return level <= nolog;
+			}
+
+			static bool Update(int msgLevel, size_t len)
+				// Account for a message written to microLog_ofs; true if it must be flushed now
+			{
+				pendingBytes += len;
+				++pendingRecords;
+
+				if(msgLevel >= level)                                { ++nLevelFlushes; return true; }
+				if(atExit && msgLevel >= fatal)                      { ++nExitFlushes;  return true; }
+				if((bytes && pendingBytes >= bytes) || (records && pendingRecords >= records))
+				                                                     { ++nSizeFlushes;  return true; }
+				if(interval > 0 && Timestamp::Now() - lastFlush >= interval * 1000000LL)
+				                                                     { ++nTimeFlushes;  return true; }
+				return false;
+			}
+
+			static bool Due()
+				// True if the pending messages should be flushed now (checked when idle)
+			{
+				if(pendingRecords == 0)
+					return false;
+				if(Always())
+					return true;
+				if(interval > 0 && Timestamp::Now() - lastFlush >= interval * 1000000LL) {
+					++nTimeFlushes;
+					return true;
+				}
+				return false;
+			}
+
+			static void Flushed() {
+				pendingBytes = pendingRecords = 0;
+				lastFlush = Timestamp::Now();
+				++nFlushes;
+				#ifdef MICRO_LOG_TIERING
+				Tiering::Flushed();
+				#endif
+			}
+
+			static void Start()
+				// Called by uLOG_START, before opening microLog_ofs
+			{
+				if(!Always()) {           // larger file buffer, to write bigger blocks
+					static std::vector<char> buffer;
+					buffer.resize(bytes > MICRO_LOG_FLUSH_BUFFER_SIZE ? bytes : MICRO_LOG_FLUSH_BUFFER_SIZE);
+					microLog_ofs.rdbuf()->pubsetbuf(&buffer[0], std::streamsize(buffer.size()));
+				}
+				lastFlush = Timestamp::Now();
+
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit(&FlushPolicy::Exit);
+					atExitSet = true;
+				}
+			}
+
+			static void Exit() {
+				if(!atExit)
+					return;
+				MICRO_LOG_LOCK;
+				if(pendingRecords > 0) {
+					microLog_ofs.flush();
+					Flushed();
+					++nExitFlushes;
+				}
+				MICRO_LOG_UNLOCK;
+			}
+		};
+
+		#ifdef MICRO_LOG_ROTATION
+
+		struct Rotation
+			/// Log rotation: when the log file reaches maxBytes, or every interval seconds, it is
+			/// renamed logFilename.YYYYMMDD-HHMMSS-mmm and the logging goes on in a new file.
+			/// The new file is opened in advance by a background thread, so the writer only
+			/// renames the files and swaps the streams. The same thread, at low priority,
+			/// closes and compresses (gzip, if built with zlib) the rotated files, and deletes
+			/// the oldest ones. Set it before uLOG_START.
+		{
+			static unsigned long long maxBytes;     // rotate when the file reaches this size (0: no limit)
+			static long               interval;     // rotate every interval seconds (0: no limit)
+			static int                keep;         // rotated files kept (0: all)
+			static bool               compress;     // gzip the rotated files
+
+			static std::atomic<unsigned long long> bytes;       // written to the current file
+			static std::atomic<long long>          deadline;    // next rotation by time (ns, 0: none)
+			static std::atomic<unsigned long>      nRotations, nDeferred;
+
+			static std::mutex              mutex;   // shared with the background thread
+			static std::condition_variable cond;
+			static std::ofstream           next;    // the next file, or the rotated one to close
+			static int                     nextFd;  // the next file, for group commit
+			static bool                    nextReady, stop;
+			static std::thread             worker;
+
+			static void Set(unsigned long long _maxBytes, long _interval = 0, int _keep = 0, bool _compress = true) {
+				maxBytes = _maxBytes; interval = _interval; keep = _keep; compress = _compress;
+			}
+
+			static std::string NextName() {
+				return logFilename + ".next";
+			}
+
+			static void Start()
+				// Called by uLOG_START, after opening microLog_ofs
+			{
+				Stop();
+				if(maxBytes == 0 && interval <= 0)
+					return;
+
+				struct stat st;
+				bytes = stat(logFilename.c_str(), &st) == 0 ? (unsigned long long)st.st_size : 0;
+				deadline = interval > 0 ? Timestamp::Now() + interval * 1000000000LL : 0;
+				stop = false;
+				worker = std::thread(&Rotation::Work);
+
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit(&Rotation::Stop);
+					atExitSet = true;
+				}
+			}
+
+			static void Stop()
+				// Stop the background thread; the rotated files left are compressed by the next Start()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stop = true;
+					cond.notify_all();
+				}
+				if(worker.joinable())
+					worker.join();
+
+				next.close();
+				if(nextReady)
+					std::remove(NextName().c_str());
+				if(nextFd >= 0)
+					close(nextFd);
+				nextFd = -1;
+				nextReady = false;
+				deadline = 0;
+			}
+
+			static bool Written(size_t len)
+				// Account for len bytes written to the log file; true if it must be rotated
+			{
+				const unsigned long long total = bytes.fetch_add(len, std::memory_order_relaxed) + len;
+				if(maxBytes && total >= maxBytes)
+					return true;
+				const long long d = deadline.load(std::memory_order_relaxed);
+				return d && Timestamp::Now() >= d;
+			}
+
+			static void Rotate();
+
+			static void Cleanup()
+				// Compress the rotated files, and delete the oldest ones
+			{
+				const size_t slash = logFilename.rfind(MICRO_LOG_DIR_SLASH);
+				const std::string dir = slash == std::string::npos ? std::string(".") : logFilename.substr(0, slash + 1);
+				const std::string prefix = (slash == std::string::npos ? logFilename : logFilename.substr(slash + 1)) + ".";
+
+				std::vector<std::string> rotated;
+				if(DIR *d = opendir(dir.c_str())) {
+					while(struct dirent *e = readdir(d)) {
+						const std::string name = e->d_name;
+						if(name.compare(0, prefix.size(), prefix) == 0 && name.size() > prefix.size() &&
+						   name[prefix.size()] >= '0' && name[prefix.size()] <= '9')
+							rotated.push_back(slash == std::string::npos ? name : dir + name);
+					}
+					closedir(d);
+				}
+				std::sort(rotated.begin(), rotated.end());
+
+				for(size_t i = 0; i < rotated.size(); ++i) {
+					if(keep > 0 && rotated.size() - i > size_t(keep))
+						std::remove(rotated[i].c_str());
+					else if(compress)
+						Compress(rotated[i]);
+				}
+			}
+
+		private:
+			static std::string RotatedName()
+			{
+				const long long now = Timestamp::Now();
+				const std::time_t t = std::time_t(now / 1000000000);
+				std::tm tm;
+				localtime_r(&t, &tm);
+				char date[32];
+				const size_t n = std::strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm);
+				std::snprintf(date + n, sizeof(date) - n, "-%03d", int(now / 1000000 % 1000));
+
+				std::string name = logFilename + "." + date;
+				for(int i = 1; access(name.c_str(), F_OK) == 0 || access((name + ".gz").c_str(), F_OK) == 0; ++i)
+					name = logFilename + "." + date + "-" + std::to_string(i);
+				return name;
+			}
+
+			static void Compress(const std::string &fname)
+			{
+				#ifdef MICRO_LOG_ZLIB
+				if(fname.size() > 3 && fname.compare(fname.size() - 3, 3, ".gz") == 0)
+					return;
+				std::ifstream in(fname, std::ios_base::binary);
+				gzFile out = gzopen((fname + ".gz").c_str(), "wb");
+				if(!in || !out) {
+					if(out) gzclose(out);
+					return;
+				}
+				std::vector<char> buf(1 << 16);
+				bool ok = true;
+				while(ok && in.read(&buf[0], std::streamsize(buf.size())), in.gcount() > 0)
+					ok = gzwrite(out, &buf[0], unsigned(in.gcount())) == int(in.gcount());
+				if(gzclose(out) == Z_OK && ok)
+					std::remove(fname.c_str());
+				else
+					std::remove((fname + ".gz").c_str());
+				#else
+				(void)fname;
+				#endif
+			}
+
+			static void Work()
+				// Background thread: prepare the next file, clean up the rotated ones
+			{
+				#ifdef __linux__
+				setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), 19);     // this thread only
+				#endif
+
+				bool cleanup = true;
+				std::unique_lock<std::mutex> lock(mutex);
+				while(!stop) {
+					if(!nextReady) {
+						std::ofstream old;
+						old.swap(next);                // the rotated file, if any
+						lock.unlock();
+
+						old.close();
+						std::remove(NextName().c_str());
+						std::ofstream file(NextName(), uLOG_OPEN_MODE);
+						int fd = -1;
+						#ifdef MICRO_LOG_GROUP_COMMIT
+						fd = open(NextName().c_str(), O_WRONLY | O_APPEND);
+						#endif
+
+						lock.lock();
+						if(nextFd >= 0)
+							close(nextFd);             // duplicated by Rotate()
+						next.swap(file);
+						nextFd = fd;
+						nextReady = next.is_open();
+						cleanup = true;
+					}
+					if(cleanup) {
+						lock.unlock();
+						Cleanup();
+						lock.lock();
+						cleanup = false;
+						continue;
+					}
+					cond.wait_for(lock, std::chrono::seconds(1));
+				}
+			}
+		};
+
+		#endif // MICRO_LOG_ROTATION
+
+		#ifdef MICRO_LOG_RELOAD
+
+		struct Reload
+			/// Configuration file read at uLOG_START, and again when it changes (inotify, or its
+			/// time checked every MICRO_LOG_RELOAD_INTERVAL ms) or on SIGHUP, by a watcher thread:
+			///     level    = warning                  # uLog::minLogLevel
+			///     fields   = debug                    # preset (default, detailed, system, debug, verbose) or mask
+			///     flush    = batch 1048576 0 error 1000   # always | level L [ms] | batch bytes [records [L [ms]]]
+			///     module net = detail                 # with MICRO_LOG_LEVELS, as Levels::SetModule()
+			///     file net/socket.cpp = info          #                          as Levels::SetFile()
+			///     function Socket:: = verbose         #                          as Levels::SetFunction()
+			/// A setting missing from the file is left as it is; the rules replace those of the
+			/// previous file. A file with errors is ignored as a whole.
+			/// Each file is parsed into a new Config, published by swapping a pointer: the
+			/// logging threads read it without locks; the previous ones are freed at exit.
+			/// The fields apply to the text fields selected at run time (not with MICRO_LOG_FIELDS);
+			/// the flush policy is applied by the thread writing the log file, and it cannot be
+			/// changed with the group commit (multithreaded synchronous mode).
+			/// Set it before uLOG_START.
+		{
+			struct Config {
+				int    level;                        // uLog::minLogLevel (-1: unchanged)
+				int    fields;                       // LogFields mask (-1: LogFields)
+				bool   flush;                        // flush policy set
+				int    flushLevel;
+				size_t flushBytes, flushRecords;
+				long   flushInterval;
+				#ifdef MICRO_LOG_LEVELS
+				std::vector<Levels::Rule> rules;
+				#endif
+
+				Config() : level(-1), fields(-1), flush(false), flushLevel(nolog), flushBytes(0), flushRecords(0), flushInterval(0) {}
+			};
+
+			static std::string path;                 // configuration file (empty: disabled)
+			static bool        sighup;               // also reload on SIGHUP
+
+			static std::atomic<const Config*> config;      // current configuration
+			static std::vector<const Config*> retired;     // previous ones (under mutex)
+			static const Config              *flushApplied; // by the thread writing the log file
+			static long long                  mtime;
+
+			static std::atomic<unsigned long> nReloads, nErrors;
+
+			static std::mutex        mutex;
+			static int               wakeFd[2];      // pipe: SIGHUP and stop
+			static int               inotifyFd;      // directory of the file (Linux)
+			static std::atomic<bool> stop;
+			static std::thread       worker;
+
+			static void Set(const std::string &_path, bool _sighup = true) {
+				path = _path; sighup = _sighup;
+			}
+
+			static unsigned Fields()
+				// Fields of the messages: from the configuration file, or LogFields
+			{
+				const Config *c = config.load(std::memory_order_acquire);
+				return c && c->fields >= 0 ? unsigned(c->fields) : LogFields::Mask();
+			}
+
+			static void ApplyFlush()
+				// Called by the thread writing microLog_ofs (lock holder, or asynchronous writer)
+			{
+				const Config *c = config.load(std::memory_order_acquire);
+				if(uLOG_LIKELY(c == flushApplied))
+					return;
+				flushApplied = c;
+				if(c && c->flush)
+					FlushPolicy::Set(c->flushLevel, c->flushBytes, c->flushRecords, c->flushInterval, FlushPolicy::atExit);
+			}
+
+			static bool Load()
+				// Read the configuration file and apply it; false if it is missing or not valid
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				struct stat st;
+				if(path.empty() || stat(path.c_str(), &st) != 0)
+					return false;
+				mtime = Stamp(st);
+
+				std::ifstream ifs(path);
+				Config *c = new Config;
+				std::string line, error;
+				for(int n = 1; error.empty() && std::getline(ifs, line); ++n)
+					if(!ParseLine(*c, line))
+						error = path + ":" + std::to_string(n) + ": " + line;
+				if(!ifs.eof() || !error.empty()) {
+					std::cerr << "Logger error: invalid configuration " << (error.empty() ? path : error) << ", not loaded." << std::endl;
+					nErrors.fetch_add(1, std::memory_order_relaxed);
+					delete c;
+					return false;
+				}
+
+				const Config *prev = config.load(std::memory_order_relaxed);
+				if(c->level >= 0)
+					minLogLevel.store(c->level, std::memory_order_relaxed);
+				#ifdef MICRO_LOG_LEVELS
+				Levels::Replace(prev ? prev->rules : Levels::Rules(), c->rules);
+				#endif
+				config.store(c, std::memory_order_release);
+				if(prev)
+					retired.push_back(prev);
+				nReloads.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			static void Start()
+				// Called by uLOG_START: loads the file, then watches it
+			{
+				Stop();
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit(&Reload::Exit);
+					atExitSet = true;
+				}
+				if(path.empty())
+					return;
+				#ifdef __linux__
+				const size_t slash = path.rfind('/');
+				const std::string dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+				inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);       // before loading: no change missed
+				if(inotifyFd >= 0 && inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+					close(inotifyFd);
+					inotifyFd = -1;
+				}
+				#endif
+				Load();
+				if(pipe(wakeFd) != 0) {
+					wakeFd[0] = wakeFd[1] = -1;
+					return;
+				}
+				fcntl(wakeFd[1], F_SETFL, O_NONBLOCK);
+				if(sighup) {
+					struct sigaction sa = {};
+					sa.sa_handler = &Reload::Hangup;
+					sa.sa_flags = SA_RESTART;
+					sigemptyset(&sa.sa_mask);
+					sigaction(SIGHUP, &sa, nullptr);
+				}
+				stop = false;
+				worker = std::thread(&Reload::Work);
+			}
+
+			static void Stop()
+			{
+				stop = true;
+				Wake();
+				if(worker.joinable())
+					worker.join();
+				if(sighup && wakeFd[1] >= 0)
+					signal(SIGHUP, SIG_DFL);
+				if(wakeFd[0] >= 0) close(wakeFd[0]);
+				if(wakeFd[1] >= 0) close(wakeFd[1]);
+				if(inotifyFd >= 0) close(inotifyFd);
+				wakeFd[0] = wakeFd[1] = inotifyFd = -1;
+			}
+
+			static void Exit()
+			{
+				Stop();
+				std::lock_guard<std::mutex> lock(mutex);
+				for(size_t i = 0; i < retired.size(); ++i)
+					delete retired[i];
+				retired.clear();
+			}
+
+		private:
+			static void Wake() {
+				const char c = 0;
+				if(wakeFd[1] >= 0 && write(wakeFd[1], &c, 1) < 0) {}
+			}
+
+			static void Hangup(int) {
+				const int e = errno;
+				Wake();
+				errno = e;
+			}
+
+			static int ParseLevel(const std::string &s)
+			{
+				static const char *names[nLogLevels] = { "nolog", "verbose", "detail", "info", "warning", "error", "critical", "fatal" };
+				for(int l = 0; l < nLogLevels; ++l)
+					if(s == names[l] || s == std::to_string(l))
+						return l;
+				return -1;
+			}
+
+			static bool ParseNumber(const std::string &s, unsigned long long &n)
+			{
+				char *end = nullptr;
+				n = std::strtoull(s.c_str(), &end, 0);
+				return !s.empty() && s[0] != '-' && *end == '\0';
+			}
+
+			static bool ParseLine(Config &c, std::string line)
+				// "name [pattern] = value...", or a comment
+			{
+				line = line.substr(0, line.find('#'));
+				const size_t eq = line.find('=');
+				std::istringstream keyStream(line.substr(0, eq)), valueStream(eq == std::string::npos ? std::string() : line.substr(eq + 1));
+				std::vector<std::string> key, value;
+				for(std::string t; keyStream >> t; ) key.push_back(t);
+				for(std::string t; valueStream >> t; ) value.push_back(t);
+				if(key.empty())
+					return eq == std::string::npos;      // empty line
+				if(key.size() > 2 || value.empty())
+					return false;
+				const std::string &name = key[0];
+				unsigned long long n = 0;
+
+				if(name == "level" && key.size() == 1 && value.size() == 1)
+					return (c.level = ParseLevel(value[0])) >= 0;
+
+				if(name == "fields" && key.size() == 1 && value.size() == 1) {
+					static const char *presets[] = { "default", "detailed", "system", "debug", "verbose" };
+					static const int   masks[]   = { MICRO_LOG_FIELDS_DEFAULT, MICRO_LOG_FIELDS_DETAILED, MICRO_LOG_FIELDS_SYSTEM,
+					                                 MICRO_LOG_FIELDS_DEBUG, MICRO_LOG_FIELDS_VERBOSE };
+					for(int i = 0; i < 5; ++i)
+						if(value[0] == presets[i])
+							return (c.fields = masks[i]) >= 0;
+					if(!ParseNumber(value[0], n) || n > 0xffff)
+						return false;
+					c.fields = int(n);
+					return true;
+				}
+
+				if(name == "flush" && key.size() == 1) {
+					#ifdef MICRO_LOG_GROUP_COMMIT
+					return false;                    // fixed by uLOG_START
+					#else
+					// always | level L [ms] | batch bytes [records [L [ms]]]
+					const std::string &mode = value[0];
+					const size_t levelArg = mode == "level" ? 1 : 3, intervalArg = levelArg + 1;
+					if(!(mode == "always" && value.size() == 1) && !(mode == "level" && value.size() >= 2 && value.size() <= 3) &&
+					   !(mode == "batch" && value.size() >= 2 && value.size() <= 5))
+						return false;
+					Config f;
+					f.flushLevel = mode == "always" ? int(nolog) : value.size() > levelArg ? ParseLevel(value[levelArg]) : int(error);
+					f.flushInterval = mode == "always" ? 0 : 1000;
+					if(f.flushLevel < 0)
+						return false;
+					if(value.size() > intervalArg) {
+						if(!ParseNumber(value[intervalArg], n))
+							return false;
+						f.flushInterval = long(n);
+					}
+					if(mode == "batch") {
+						if(!ParseNumber(value[1], n))
+							return false;
+						f.flushBytes = size_t(n);
+						if(value.size() > 2) {
+							if(!ParseNumber(value[2], n))
+								return false;
+							f.flushRecords = size_t(n);
+						}
+					}
+					c.flush = true;
+					c.flushLevel = f.flushLevel; c.flushBytes = f.flushBytes; c.flushRecords = f.flushRecords; c.flushInterval = f.flushInterval;
+					return true;
+					#endif
+				}
+
+				#ifdef MICRO_LOG_LEVELS
+				Levels::Rule r = { Levels::module, key.size() == 2 ? key[1] : std::string(), ParseLevel(value[0]) };
+				if(name == "file")          r.kind = Levels::file;
+				else if(name == "function") r.kind = Levels::function;
+				else if(name != "module")   return false;
+				if(key.size() != 2 || value.size() != 1 || r.level < 0)
+					return false;
+				c.rules.push_back(r);
+				return true;
+				#else
+				return false;                        // module/file/function: MICRO_LOG_LEVELS
+				#endif
+			}
+
+			static long long Stamp(const struct stat &st)
+				// Modification time (ns) and size of the file, to detect a change
+			{
+				#if defined(__APPLE__)
+				const long long ns = (long long)st.st_mtimespec.tv_nsec;
+				#else
+				const long long ns = (long long)st.st_mtim.tv_nsec;
+				#endif
+				return ((long long)st.st_mtime * 1000000000LL + ns) ^ ((long long)st.st_size << 40);
+			}
+
+			static bool Changed()
+			{
+				struct stat st;
+				std::lock_guard<std::mutex> lock(mutex);
+				return stat(path.c_str(), &st) == 0 && Stamp(st) != mtime;
+			}
+
+			static void Work()
+				// Watcher thread: directory events of the file (inotify), SIGHUP, or its time
+			{
+				struct pollfd fds[2] = { { wakeFd[0], POLLIN, 0 }, { inotifyFd, POLLIN, 0 } };
+				while(!stop.load(std::memory_order_acquire)) {
+					const int n = poll(fds, inotifyFd >= 0 ? 2 : 1, inotifyFd >= 0 ? -1 : MICRO_LOG_RELOAD_INTERVAL);
+					if(n < 0 && errno != EINTR)
+						break;
+					bool hangup = false, event = false;
+					char buf[4096];
+					if(n > 0 && (fds[0].revents & POLLIN))
+						hangup = read(wakeFd[0], buf, sizeof(buf)) > 0;     // SIGHUP (or stop)
+					if(n > 0 && inotifyFd >= 0 && (fds[1].revents & POLLIN))
+						while(read(inotifyFd, buf, sizeof(buf)) > 0)
+							event = true;                                   // any file of the directory
+					if(stop.load(std::memory_order_acquire))
+						break;
+					if(hangup || ((event || inotifyFd < 0) && Changed()))
+						Load();
+				}
+			}
+		};
+
+		#endif // MICRO_LOG_RELOAD
+
+		inline void WriteToFile(int level, const char *data, size_t len)
+			// Write to microLog_ofs, flushing according to FlushPolicy (caller holds the lock)
+		{
+			#ifdef MICRO_LOG_RELOAD
+			Reload::ApplyFlush();
+			#endif
+			microLog_ofs.write(data, std::streamsize(len));
+			#ifdef MICRO_LOG_TIERING
+			Tiering::Written(len);
+			#endif
+			if(FlushPolicy::Update(level, len)) {
+				microLog_ofs.flush();
+				FlushPolicy::Flushed();
+			}
+			#ifdef MICRO_LOG_ROTATION
+			if(Rotation::Written(len))
+				Rotation::Rotate();
+			#endif
+		}
+
+
+
+		#ifdef MICRO_LOG_ASYNC
+
+		struct Async
+			/// Asynchronous mode: the log messages are assembled by the calling thread in its
+			/// Record, pushed to a bounded lock-free multi-producer queue, and
+			/// written to microLog_ofs in batches by a single writer thread.
+			/// Before Start() and after Stop() the messages are written directly, under fileMutex,
+			/// which the writer thread also holds while it writes; Stop() waits for the pushes in
+			/// progress before writing the last queued messages.
+		{
+			struct Slot {
+				std::atomic<size_t> seq;
+				int                 level;
+				size_t              len;
+				char                data[maxLogSize];
+			};
+
+			struct Queue {
+				Slot  *slots;
+				size_t mask;
+				alignas(64) std::atomic<size_t> enqueuePos;
+				alignas(64) size_t dequeuePos;            // single consumer: the writer thread
+
+				Queue() : slots(nullptr), mask(0), enqueuePos(0), dequeuePos(0) {}
+			};
+
+			static std::atomic<int> policy, dropLevel;  // overload policy, see async_block, ...
+			static std::atomic<unsigned long> nQueued, nDropped, nBlocked, nBatches;
+			static Queue queue;
+			static std::thread writer;
+			static std::atomic<bool> running, stop;
+			static std::atomic<unsigned> inFlight;  // pushes in progress, waited for by Stop()
+			static std::mutex fileMutex;            // microLog_ofs, between the writer and the direct writes
+
+			static void SetOverloadPolicy(int _policy, int _dropLevel = warning) {
+				dropLevel.store(_dropLevel, std::memory_order_relaxed);
+				policy.store(_policy, std::memory_order_relaxed);
+			}
+
+			static bool TryPush(int level, const char *data, size_t len)
+			{
+				size_t pos = queue.enqueuePos.load(std::memory_order_relaxed);
+				Slot *slot;
+
+				for(;;) {
+					slot = &queue.slots[pos & queue.mask];
+					size_t seq = slot->seq.load(std::memory_order_acquire);
+					std::ptrdiff_t dif = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+					if(dif == 0) {
+						if(queue.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+							break;
+					}
+					else if(dif < 0)
+						return false;                        // queue full
+					else
+						pos = queue.enqueuePos.load(std::memory_order_relaxed);
+				}
+
+				slot->level = level;
+				slot->len = len;
+				std::memcpy(slot->data, data, len);
+				slot->seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+
+			static bool Push(int level, const char *data, size_t len, bool droppable = true)
+				// false if the message is dropped
+			{
+				inFlight.fetch_add(1);                     // seq_cst, against running in Stop()
+				const bool pushed = running.load() && PushQueued(level, data, len, droppable);
+				inFlight.fetch_sub(1, std::memory_order_release);
+				if(pushed)
+					return true;
+				if(!running.load(std::memory_order_acquire)) {
+					WriteDirect(data, len);                // writer not started or already stopped
+					return true;
+				}
+				return false;
+			}
+
+			static void WriteDirect(const char *data, size_t len) {
+				std::lock_guard<std::mutex> lock(fileMutex);
+				microLog_ofs.write(data, std::streamsize(len));
+			}
+
+		private:
+			static bool PushQueued(int level, const char *data, size_t len, bool droppable)
+				// false if the message is dropped, or not queued because the writer stopped
+			{
+				if(TryPush(level, data, len)) {
+					nQueued.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+
+				const int overload = policy.load(std::memory_order_relaxed);
+				if(droppable && (overload == async_drop ||
+				                 (overload == async_drop_below_level && level < dropLevel.load(std::memory_order_relaxed)))) {
+					nDropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				nBlocked.fetch_add(1, std::memory_order_relaxed);
+				while(!TryPush(level, data, len)) {
+					if(!running.load(std::memory_order_acquire))
+						return false;
+					std::this_thread::yield();
+				}
+				nQueued.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			static size_t Pop(char *dst, int &level)
+				// Move the oldest message to dst, return its length (0 if the queue is empty)
+			{
+				Slot &slot = queue.slots[queue.dequeuePos & queue.mask];
+				if(slot.seq.load(std::memory_order_acquire) != queue.dequeuePos + 1)
+					return 0;
+				size_t len = slot.len;
+				level = slot.level;
+				std::memcpy(dst, slot.data, len);
+				slot.seq.store(queue.dequeuePos + queue.mask + 1, std::memory_order_release);
+				++queue.dequeuePos;
+				return len;
+			}
+
+			static bool Drain(std::vector<char> &batch)
+				// Write to file as many queued messages as fit in a batch
+			{
+				size_t used = 0, len;
+				int level;
+				bool flush = false;
+				#ifdef MICRO_LOG_RELOAD
+				Reload::ApplyFlush();
+				#endif
+				const bool always = FlushPolicy::Always();    // flushed when the queue is empty
+				while(used + maxLogSize <= batch.size() && (len = Pop(&batch[used], level)) > 0) {
+					used += len;
+					if(always) {
+						FlushPolicy::pendingBytes += len;
+						++FlushPolicy::pendingRecords;
+					}
+					else
+						flush |= FlushPolicy::Update(level, len);
+				}
+				if(used == 0)
+					return false;
+				std::lock_guard<std::mutex> lock(fileMutex);
+				microLog_ofs.write(&batch[0], std::streamsize(used));
+				#ifdef MICRO_LOG_TIERING
+				Tiering::Written(used);
+				#endif
+				if(flush) {
+					microLog_ofs.flush();
+					FlushPolicy::Flushed();
+				}
+				#ifdef MICRO_LOG_ROTATION
+				if(Rotation::Written(used))
+					Rotation::Rotate();
+				#endif
+				nBatches.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			static void Writer()
+			{
+				std::vector<char> batch(MICRO_LOG_ASYNC_BATCH_SIZE < 2*maxLogSize ? 2*maxLogSize : MICRO_LOG_ASYNC_BATCH_SIZE);
+
+				for(;;) {
+					if(Drain(batch))
+						continue;
+					if(FlushPolicy::Due()) {             // queue empty: flush if required
+						std::lock_guard<std::mutex> lock(fileMutex);
+						microLog_ofs.flush();
+						FlushPolicy::Flushed();
+					}
+					if(stop.load(std::memory_order_acquire))
+						break;
+					std::this_thread::sleep_for(std::chrono::microseconds(MICRO_LOG_ASYNC_IDLE_US));
+				}
+			}
+
+		public:
+			static void Start(size_t capacity = MICRO_LOG_ASYNC_QUEUE_SIZE)
+			{
+				if(running)
+					return;
+
+				if(queue.slots == nullptr) {
+					size_t n = 2;
+					while(n < capacity) n <<= 1;
+					queue.slots = new Slot[n];
+					queue.mask = n - 1;
+				}
+				for(size_t i = 0; i <= queue.mask; ++i)
+					queue.slots[i].seq.store(i, std::memory_order_relaxed);
+				queue.enqueuePos.store(0, std::memory_order_relaxed);
+				queue.dequeuePos = 0;
+
+				stop = false;
+				running = true;
+				writer = std::thread(&Async::Writer);
+
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit(&Async::Stop);
+					atExitSet = true;
+				}
+			}
+
+			static void Stop()
+				// Write all the queued messages and stop the writer thread
+			{
+				if(!running.exchange(false))
+					return;
+				while(inFlight.load() != 0)              // pushes that found the writer running
+					std::this_thread::yield();
+				stop = true;
+				if(writer.joinable())
+					writer.join();
+
+				std::vector<char> batch(2*maxLogSize);   // messages pushed while the writer was stopping
+				while(Drain(batch)) {}
+				std::lock_guard<std::mutex> lock(fileMutex);
+				microLog_ofs.flush();
+				FlushPolicy::Flushed();
+			}
+		};
+
+		#endif // MICRO_LOG_ASYNC
+
+
+		#ifdef MICRO_LOG_GROUP_COMMIT
+
+		struct GroupCommit
+			/// Synchronous multithreaded mode: the threads writing at the same time queue their
+			/// records in a group; the first of them not finding another writer at work (the
+			/// leader) writes the whole group with a single writev(), while the others (the
+			/// followers) wait for it. New records form the next group in the meantime.
+		{
+			struct Group {
+				struct iovec iov[MICRO_LOG_GROUP_SIZE];
+				int          n;
+			};
+
+			static std::mutex              mutex;
+			static std::condition_variable cond;
+			static Group                   groups[2];
+			static Group                  *filling;                    // group accepting records
+			static unsigned long long      fillingSeq, writtenSeq;
+			static bool                    leaderActive;
+			static int                     fd;
+			static std::atomic<unsigned long> nGroups, nRecords;
+
+			static void Open(const std::string &logfname)
+			{
+				if(fd >= 0)
+					close(fd);
+				fd = open(logfname.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+			}
+
+			static void Write(const char *data, size_t len)
+				// Return when the record has been written
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while(filling->n == MICRO_LOG_GROUP_SIZE) {    // group full: write it or wait
+					if(!leaderActive)
+						Lead(lock);
+					else
+						cond.wait(lock);
+				}
+
+				filling->iov[filling->n].iov_base = const_cast<char*>(data);
+				filling->iov[filling->n].iov_len = len;
+				++filling->n;
+				const unsigned long long seq = fillingSeq;
+
+				while(writtenSeq < seq) {
+					if(!leaderActive)
+						Lead(lock);       // the group with this record is the filling one
+					else
+						cond.wait(lock);
+				}
+			}
+
+		private:
+			static void Lead(std::unique_lock<std::mutex> &lock)
+			{
+				leaderActive = true;
+				Group *group = filling;
+				const unsigned long long seq = fillingSeq++;
+				filling = (filling == &groups[0]) ? &groups[1] : &groups[0];    // already written
+				filling->n = 0;
+
+				lock.unlock();
+				#if defined(MICRO_LOG_ROTATION) || defined(MICRO_LOG_TIERING)
+				size_t len = 0;
+				for(int i = 0; i < group->n; ++i)
+					len += group->iov[i].iov_len;
+				#endif
+				WriteAll(group->iov, group->n);
+				nGroups.fetch_add(1, std::memory_order_relaxed);
+				nRecords.fetch_add((unsigned long)group->n, std::memory_order_relaxed);
+				#ifdef MICRO_LOG_TIERING
+				Tiering::Synced(len);
+				#endif
+				#ifdef MICRO_LOG_ROTATION
+				if(Rotation::Written(len)) {
+					MICRO_LOG_LOCK;
+					Rotation::Rotate();
+					MICRO_LOG_UNLOCK;
+				}
+				#endif
+				lock.lock();
+
+				writtenSeq = seq;
+				leaderActive = false;
+				cond.notify_all();
+			}
+
+			static void WriteAll(struct iovec *iov, int n)
+			{
+				while(n > 0) {
+					ssize_t written = writev(fd, iov, n);
+					if(written < 0) {
+						if(errno == EINTR) continue;
+						return;
+					}
+					while(n > 0 && size_t(written) >= iov->iov_len) {    // skip the written buffers
+						written -= ssize_t(iov->iov_len);
+						++iov; --n;
+					}
+					if(n > 0) {
+						iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+						iov->iov_len -= size_t(written);
+					}
+				}
+			}
+		};
+
+		#endif // MICRO_LOG_GROUP_COMMIT
+
+
+		#ifdef MICRO_LOG_MMAP
+
+		struct MappedFile
+			/// Memory mapped log file: the file grows by preallocated segments of segmentSize
+			/// bytes, each mapped in memory. A writer reserves its bytes with an atomic add and
+			/// copies the record into the mapping, with no system calls and no lock (records
+			/// crossing the end of a segment are split). Close() truncates the file to its real
+			/// length; after a crash, Open() removes the zeros left at the end of the file.
+			/// The file can also have zeros in the middle, in place of whole records: the bytes
+			/// reserved by a writer not done at the crash, or the segments that could not be
+			/// mapped (e.g. no space left), whose records are dropped. microLog_decode skips them.
+			/// Note: a child process after a fork() must log to its own file (uLOG_START).
+		{
+			static const int nSlots = 4;                   // segments mapped at the same time
+
+			struct Slot {
+				std::atomic<long long> index;              // segment mapped (-1: none)
+				char                  *base;               // nullptr: segment not mapped, its records dropped
+				std::atomic<size_t>    written;            // bytes copied in the segment
+
+				Slot() : index(-1), base(nullptr), written(0) {}
+			};
+
+			static int                             fd;
+			static size_t                          segmentSize;     // multiple of the page size
+			static std::atomic<unsigned long long> tail;            // end of the reserved bytes
+			static unsigned long long              head;            // length of the file when opened
+			static Slot                            slots[nSlots];
+			static std::atomic<unsigned long>      nSegments, nFailures;
+
+			static bool Open(const std::string &logfname)
+			{
+				Close();
+				fd = open(logfname.c_str(), O_RDWR | O_CREAT, 0644);
+				if(fd < 0)
+					return false;
+				head = Recover();
+				tail.store(head, std::memory_order_relaxed);
+
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit(&MappedFile::Close);
+					atExitSet = true;
+				}
+				return true;
+			}
+
+			static void Close()
+				// Unmap the segments and truncate the file (no writers must be active)
+			{
+				if(fd < 0)
+					return;
+				for(int i = 0; i < nSlots; ++i) {
+					if(slots[i].base)
+						munmap(slots[i].base, segmentSize);
+					slots[i].base = nullptr;
+					slots[i].index.store(-1, std::memory_order_relaxed);
+				}
+				if(ftruncate(fd, off_t(tail.load()))) {}
+				close(fd);
+				fd = -1;
+			}
+
+			static unsigned long long Completed(unsigned long long from)
+				// End of the segments completely written, from offset from
+			{
+				const unsigned long long end = tail.load(std::memory_order_acquire) / segmentSize;
+				unsigned long long k = from / segmentSize;
+				for(; k < end; ++k) {
+					const Slot &slot = slots[k % nSlots];
+					const long long index = slot.index.load(std::memory_order_acquire);
+					const bool done = (k + 1) * segmentSize <= head || index > (long long)k ||
+					                  (index == (long long)k && slot.written.load(std::memory_order_acquire) == segmentSize);
+					if(!done)
+						break;
+				}
+				return k * segmentSize > from ? k * segmentSize : from;
+			}
+
+			static bool Write(const char *data, size_t len)
+				// Copy the record into its segments; false if one of them is not mapped: the
+				// record is dropped whole, its bytes are still counted for the segments to retire
+			{
+				unsigned long long pos = tail.fetch_add(len, std::memory_order_relaxed);
+				bool mapped = true;
+				for(unsigned long long p = pos; p < pos + len; p = (p / segmentSize + 1) * segmentSize)
+					mapped = Map((long long)(p / segmentSize))->base && mapped;
+				while(len > 0) {
+					const long long k = (long long)(pos / segmentSize);
+					const size_t offset = size_t(pos % segmentSize);
+					const size_t n = len < segmentSize - offset ? len : segmentSize - offset;
+					Slot *slot = Map(k);
+					if(mapped)
+						std::memcpy(slot->base + offset, data, n);
+					slot->written.fetch_add(n, std::memory_order_release);
+					pos += n; data += n; len -= n;
+				}
+				return mapped;
+			}
+
+		private:
+			static Slot* Map(long long k)
+				// The slot of segment k, mapped if needed (base is nullptr if it cannot be)
+			{
+				Slot &slot = slots[k % nSlots];
+				for(;;) {
+					const long long index = slot.index.load(std::memory_order_acquire);
+					if(index == k)
+						return &slot;
+					if(index >= 0 && slot.written.load(std::memory_order_acquire) < segmentSize) {
+						sched_yield();             // an older segment is still being written
+						continue;
+					}
+
+					MICRO_LOG_LOCK;
+					if(slot.index.load(std::memory_order_relaxed) == index) {
+						if(slot.base)
+							munmap(slot.base, segmentSize);
+						slot.base = nullptr;
+						void *base = MAP_FAILED;
+						if(posix_fallocate(fd, off_t(k) * off_t(segmentSize), off_t(segmentSize)) == 0)
+							base = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off_t(k) * off_t(segmentSize));
+						if(base != MAP_FAILED) {
+							slot.base = static_cast<char*>(base);
+							nSegments.fetch_add(1, std::memory_order_relaxed);
+						}
+						else if(nFailures.fetch_add(1, std::memory_order_relaxed) == 0)
+							std::cerr << "Logger error: cannot map a new segment of the log file, its messages are dropped." << std::endl;
+						// Not mapped: the slot still takes segment k, retired once all its bytes are counted
+						const unsigned long long start = (unsigned long long)k * segmentSize;
+						slot.written.store(head <= start ? 0 : size_t(head - start < segmentSize ? head - start : segmentSize),
+						                   std::memory_order_relaxed);     // bytes already in the file
+						slot.index.store(k, std::memory_order_release);
+					}
+					MICRO_LOG_UNLOCK;
+				}
+			}
+
+		public:
+			static unsigned long long DataEnd(int file)
+				// Length of the log, without the zeros preallocated and not written before a crash
+			{
+				off_t end = lseek(file, 0, SEEK_END);
+				if(end <= 0 || end % off_t(segmentSize) != 0)     // closed by Close()
+					return end < 0 ? 0 : (unsigned long long)end;
+				char buf[4096];
+				while(end > 0) {
+					const off_t start = end > off_t(sizeof(buf)) ? end - off_t(sizeof(buf)) : 0;
+					if(pread(file, buf, size_t(end - start), start) != ssize_t(end - start))
+						break;
+					size_t i = size_t(end - start);
+					while(i > 0 && buf[i - 1] == '\0') --i;
+					end = start + off_t(i);
+					if(i > 0)
+						break;
+				}
+				return (unsigned long long)end;
+			}
+
+		private:
+			static unsigned long long Recover()
+			{
+				const unsigned long long end = DataEnd(fd);
+				if(ftruncate(fd, off_t(end))) {}
+				return end;
+			}
+		};
+
+		#endif // MICRO_LOG_MMAP
+
+
+		#ifdef MICRO_LOG_TIERING
+
+		inline unsigned long long Tiering::Committed(bool all)
+			// End of the log file that can be copied; all: no writers active
+		{
+		#ifdef MICRO_LOG_MMAP
+			if(MappedFile::fd >= 0)                    // the segments completely written
+				return all ? MappedFile::tail.load() : MappedFile::Completed(drained);
+			return MappedFile::DataEnd(hotFd);         // without the preallocated zeros
+		#else
+			if(!all)
+				return committed.load(std::memory_order_acquire);
+			struct stat st;
+			return fstat(hotFd, &st) == 0 ? (unsigned long long)st.st_size : drained;
+		#endif
+		}
+
+		#endif // MICRO_LOG_TIERING
+
+
+		#if defined(MICRO_LOG_CLIENT) || defined(MICRO_LOG_SERVER)
+
+		struct SharedRing
+			/// Log messages of a client process to microLog_server, in shared memory: a bounded
+			/// multi-producer queue, as Async's, without pointers (mapped at different addresses).
+			/// The server sets sleeping before waiting on the client's eventfd; only then the
+			/// producers signal it. The client can write the whole mapping, so the server reads
+			/// through its own Cursor and never trusts the shared header after Attach.
+		{
+			struct Slot {
+				std::atomic<unsigned long long> seq;
+				int                             level;
+				unsigned                        len;
+				char                            data[maxLogSize];
+			};
+
+			struct Hello {                                // attach request, with the ring and eventfd
+				char     magic[8];
+				unsigned version, nSlots;
+				int      pid;
+				char     logFilename[PATH_MAX];
+			};
+
+			struct Cursor {                               // server side, private: nSlots checked at attach
+				unsigned           nSlots;
+				unsigned long long dequeuePos;
+			};
+
+			static const unsigned version = 2;
+			static const char* Magic() { return "uLOGring"; }
+
+			char     magic[8];
+			unsigned nSlots;                              // a power of 2
+			int      pid;
+			alignas(64) std::atomic<unsigned>           sleeping;
+			alignas(64) std::atomic<unsigned long long> enqueuePos;
+			alignas(64) Slot                            slots[1];        // nSlots
+
+			static size_t Size(unsigned n) {
+				return sizeof(SharedRing) + (n - 1) * sizeof(Slot);
+			}
+
+			void Init(unsigned n, int _pid)
+				// In zeroed shared memory
+			{
+				std::memcpy(magic, Magic(), sizeof(magic));
+				nSlots = n;
+				pid = _pid;
+				sleeping.store(0, std::memory_order_relaxed);
+				enqueuePos.store(0, std::memory_order_relaxed);
+				for(unsigned i = 0; i < n; ++i)
+					slots[i].seq.store(i, std::memory_order_relaxed);
+			}
+
+			bool Valid(size_t size) const {
+				return std::memcmp(magic, Magic(), sizeof(magic)) == 0 && nSlots > 0 && (nSlots & (nSlots - 1)) == 0 &&
+				       size >= Size(nSlots);
+			}
+
+			bool TryPush(int level, const char *data, size_t len)
+			{
+				unsigned long long pos = enqueuePos.load(std::memory_order_relaxed);
+				Slot *slot;
+				for(;;) {
+					slot = &slots[pos & (nSlots - 1)];
+					const long long dif = (long long)slot->seq.load(std::memory_order_acquire) - (long long)pos;
+					if(dif == 0) {
+						if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+							break;
+					}
+					else if(dif < 0)
+						return false;                     // ring full
+					else
+						pos = enqueuePos.load(std::memory_order_relaxed);
+				}
+				slot->level = level;
+				slot->len = unsigned(len);
+				std::memcpy(slot->data, data, len);
+				slot->seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+
+			size_t Pop(Cursor &cur, char *dst, int &level)
+				// Move the oldest message to dst, return its length (0 if the ring is empty)
+			{
+				Slot &slot = slots[cur.dequeuePos & (cur.nSlots - 1)];
+				if(slot.seq.load(std::memory_order_acquire) != cur.dequeuePos + 1)
+					return 0;
+				const size_t len = slot.len < maxLogSize ? slot.len : maxLogSize;
+				level = slot.level;
+				if(level < 0 || level >= nLogLevels)
+					level = nolog;
+				std::memcpy(dst, slot.data, len);
+				slot.seq.store(cur.dequeuePos + cur.nSlots, std::memory_order_release);
+				++cur.dequeuePos;
+				return len;
+			}
+
+			bool Empty(const Cursor &cur) const {
+				return slots[cur.dequeuePos & (cur.nSlots - 1)].seq.load(std::memory_order_acquire) != cur.dequeuePos + 1;
+			}
+		};
+
+		#endif // MICRO_LOG_CLIENT, MICRO_LOG_SERVER
+
+
+		#ifdef MICRO_LOG_CLIENT
+
+		struct Client
+			/// Client mode: uLOG_START attaches the process to microLog_server through the Unix
+			/// socket socketPath, sending it a SharedRing (memfd) and an eventfd. Then the messages
+			/// to microLog_ofs are pushed to the ring, and written to logFilename by the server.
+			/// At exit the client detaches, after the server has written all its messages.
+			/// Without a server, the process writes the log file itself.
+			/// Note: a child process after a fork() must attach again (uLOG_START).
+		{
+			static std::string               socketPath;     // set before uLOG_START
+			static std::atomic<SharedRing*>  ring;           // nullptr: not attached
+			static size_t                    ringSize;
+			static int                       sock, eventFd, pid;
+			static std::atomic<unsigned long> nQueued, nBlocked, nWakeups;
+
+			static bool Attach(const std::string &logfname)
+			{
+				Detach();
+
+				SharedRing::Hello hello = {};
+				std::memcpy(hello.magic, SharedRing::Magic(), sizeof(hello.magic));
+				hello.version = SharedRing::version;
+				hello.nSlots = 1;
+				while(hello.nSlots < MICRO_LOG_CLIENT_RING_SIZE) hello.nSlots <<= 1;
+				hello.pid = getpid();
+				std::string path = logfname;
+				char cwd[PATH_MAX];
+				if(path.empty() || path[0] != '/')                   // the server has another directory
+					path = std::string(getcwd(cwd, sizeof(cwd)) ? cwd : ".") + "/" + path;
+				if(path.size() >= sizeof(hello.logFilename))
+					return false;
+				std::memcpy(hello.logFilename, path.c_str(), path.size() + 1);
+
+				struct sockaddr_un addr = {};
+				addr.sun_family = AF_UNIX;
+				if(socketPath.size() >= sizeof(addr.sun_path))
+					return false;
+				std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+				const size_t size = SharedRing::Size(hello.nSlots);
+				const int memFd = memfd_create("microLog", MFD_CLOEXEC);
+				eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+				sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+				void *shared = MAP_FAILED;
+				bool ok = memFd >= 0 && eventFd >= 0 && sock >= 0 && ftruncate(memFd, off_t(size)) == 0 &&
+				          (shared = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0)) != MAP_FAILED;
+				if(ok) {
+					static_cast<SharedRing*>(shared)->Init(hello.nSlots, hello.pid);
+					ok = connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+				}
+				if(ok) {
+					int fds[2] = { memFd, eventFd };
+					char control[CMSG_SPACE(sizeof(fds))] = {};
+					struct iovec iov = { &hello, sizeof(hello) };
+					struct msghdr msg = {};
+					msg.msg_iov = &iov;
+					msg.msg_iovlen = 1;
+					msg.msg_control = control;
+					msg.msg_controllen = sizeof(control);
+					struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+					cmsg->cmsg_level = SOL_SOCKET;
+					cmsg->cmsg_type = SCM_RIGHTS;
+					cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+					std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+					ok = sendmsg(sock, &msg, MSG_NOSIGNAL) == ssize_t(sizeof(hello)) && Reply(1000) == 'A';
+				}
+				if(memFd >= 0)
+					close(memFd);                                    // the mapping stays
+				if(!ok) {
+					if(shared != MAP_FAILED)
+						munmap(shared, size);
+					Close();
+					return false;
+				}
+
+				pid = hello.pid;
+				ringSize = size;
+				ring.store(static_cast<SharedRing*>(shared), std::memory_order_release);
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit(&Client::Detach);
+					atExitSet = true;
+				}
+				return true;
+			}
+
+			static void Detach()
+				// Wait until the server has written all the messages (no messages must be logged meanwhile)
+			{
+				SharedRing *r = ring.exchange(nullptr);
+				if(!r) {
+					Close();
+					return;
+				}
+				if(pid == getpid()) {                               // not a child after a fork(): the connection is ours
+					Wake(r, true);
+					if(send(sock, "D", 1, MSG_NOSIGNAL) == 1)
+						Reply(5000);
+				}
+				munmap(r, ringSize);
+				Close();
+			}
+
+			static bool Push(int level, const char *data, size_t len)
+				// Queue a message to the server; false if the server is gone (write it directly)
+			{
+				SharedRing *r = ring.load(std::memory_order_acquire);
+				if(!r->TryPush(level, data, len)) {
+					nBlocked.fetch_add(1, std::memory_order_relaxed);
+					for(unsigned n = 1; !r->TryPush(level, data, len); ++n) {
+						Wake(r, true);
+						if(n % 1024 == 0 && !ServerAlive()) {
+							Lost(r);
+							return false;
+						}
+						std::this_thread::yield();
+					}
+				}
+				nQueued.fetch_add(1, std::memory_order_relaxed);
+				Wake(r, false);
+				return true;
+			}
+
+		private:
+			static void Wake(SharedRing *r, bool always)
+				// Signal the server, if it is waiting for messages
+			{
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(always || r->sleeping.load(std::memory_order_relaxed)) {
+					const unsigned long long one = 1;
+					if(write(eventFd, &one, sizeof(one)) == ssize_t(sizeof(one)))
+						nWakeups.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+
+			static int Reply(int timeoutMs)
+			{
+				struct pollfd p = { sock, POLLIN, 0 };
+				char c = 0;
+				if(poll(&p, 1, timeoutMs) != 1 || recv(sock, &c, 1, 0) != 1)
+					return 0;
+				return c;
+			}
+
+			static bool ServerAlive() {
+				struct pollfd p = { sock, POLLIN, 0 };
+				return poll(&p, 1, 0) == 0;                      // the server never writes unasked
+			}
+
+			static void Lost(SharedRing *r)
+				// The server is gone: write the log file directly (the ring stays mapped)
+			{
+				MICRO_LOG_LOCK;
+				if(ring.compare_exchange_strong(r, nullptr)) {
+					std::cerr << "Logger error: the log server is gone, writing the log file directly." << std::endl;
+					if(!microLog_ofs.is_open())
+						microLog_ofs.open(logFilename, uLOG_OPEN_MODE);
+				}
+				MICRO_LOG_UNLOCK;
+			}
+
+			static void Close()
+			{
+				if(sock >= 0)    close(sock);
+				if(eventFd >= 0) close(eventFd);
+				sock = eventFd = -1;
+			}
+		};
+
+		#endif // MICRO_LOG_CLIENT
+
+
+		inline bool WriteMessage(std::ostream *target, int level, const char *data, size_t len, bool droppable)
+			// Write a complete message to its stream; false if it is dropped
+		{
+			#ifndef MICRO_LOG_ASYNC
+			(void)droppable;                       // only the asynchronous queue drops messages
+			#endif
+
+			#ifdef MICRO_LOG_CLIENT
+			if(target == &microLog_ofs && Client::ring.load(std::memory_order_acquire) &&
+			   Client::Push(level, data, len))     // the server checks the space
+				return true;
+			#endif
+
+			if(!spaceGuard.Consume(len))           // not enough space: drop the message
+				return false;
+
+			if(target == &microLog_ofs) {
+			#ifdef MICRO_LOG_MMAP
+				if(MappedFile::fd >= 0)
+					return MappedFile::Write(data, len);
+			#endif
+			#if defined(MICRO_LOG_ASYNC)
+				return Async::Push(level, data, len, droppable);
+			#elif defined(MICRO_LOG_GROUP_COMMIT)
+				if(GroupCommit::fd >= 0 && FlushPolicy::Always())      // each message is written at once
+					GroupCommit::Write(data, len);
+				else {
+					MICRO_LOG_LOCK;
+					WriteToFile(level, data, len);
+					MICRO_LOG_UNLOCK;
+				}
+			#else
+				MICRO_LOG_LOCK;
+				WriteToFile(level, data, len);
+				MICRO_LOG_UNLOCK;
+			#endif
+			}
+			else {
+				MICRO_LOG_LOCK;
+				target->write(data, std::streamsize(len));
+				target->flush();
+				MICRO_LOG_UNLOCK;
+			}
+			return true;
+		}
+
+		inline void Write(std::ostream *target, int level, const char *data, size_t len, bool droppable = true)
+			// Write a complete message to its stream; droppable: by the asynchronous overload policy
+		{
+			#ifndef MICRO_LOG_DLL
+			if(WriteMessage(target, level, data, len, droppable))
+				Statistics::Emitted(level, len);
+			else
+				Statistics::Dropped();
+			#else
+			WriteMessage(target, level, data, len, droppable);
+			#endif
+		}
+
+		#ifdef MICRO_LOG_BINARY
+		inline void BeginText(Record &r)
+			// Binary mode: start a text record to microLog_ofs
+		{
+			r.data[0] = BinaryLog::text;
+			r.data[BinaryLog::recordHead] = char(r.level);
+			r.len = BinaryLog::textHead;
+			r.framed = true;
+			r.binary = false;
+		}
+		#endif
+
+		#ifdef MICRO_LOG_STRUCTURED
+
+		struct Structured
+			/// MICRO_LOG_STRUCTURED: each uLOG message as a JSON object per line (MICRO_LOG_JSON),
+			/// or as a logfmt line (MICRO_LOG_LOGFMT), with the fields selected in LogFields:
+			///   {"date":"2026-10-16T22:48:14","level":"INFO","line":42,"msg":"text","fd":12}
+			///   date=2026-10-16T22:48:14 level=INFO line=42 msg="text" fd=12
+			/// The keys are string literals, encoded at compile time; numbers (elapsed time, pid,
+			/// uid, line, and the numbers of uLOG_KV) are written as numbers. The message text is
+			/// formatted as usual, then escaped in place when the message ends, scanning it 8 bytes
+			/// at a time for the bytes to escape ('"', '\\', controls); the key-values (uLOG_KV)
+			/// are kept apart meanwhile, and written after it.
+		{
+			template <size_t n>
+			static void Literal(Record &r, const char (&s)[n]) {
+				r.Append(s, n - 1);
+			}
+
+			static bool Special(unsigned char c) {
+				return c < 0x20 || c == '"' || c == '\\';
+			}
+
+			static size_t Cut(const Record &r, size_t from, size_t len)
+				// len, moved back to the start of a UTF-8 sequence
+			{
+				while(len > from && (static_cast<unsigned char>(r.data[len]) & 0xC0) == 0x80)
+					--len;
+				return len;
+			}
+
+			static void Escape(Record &r, size_t from, size_t limit)
+				// Escape r.data[from, r.len) in place, truncated to end at limit at most
+			{
+				if(limit < from)
+					limit = from;
+				const unsigned long long ones = 0x0101010101010101ULL, highs = ones << 7;
+				size_t i = from;
+				for(; i + 8 <= r.len; i += 8) {
+					unsigned long long w;
+					std::memcpy(&w, r.data + i, 8);
+					const unsigned long long q = w ^ (ones * '"'), b = w ^ (ones * '\\');
+					if((((w - ones * 0x20) & ~w) | ((q - ones) & ~q) | ((b - ones) & ~b)) & highs)
+						break;
+				}
+				while(i < r.len && !Special(static_cast<unsigned char>(r.data[i])))
+					++i;
+				if(i == r.len) {               // nothing to escape
+					if(r.len > limit)
+						r.len = Cut(r, from, limit);
+					return;
+				}
+
+				char rest[maxLogSize];
+				const size_t n = r.len - i;
+				std::memcpy(rest, r.data + i, n);
+				r.len = i < limit ? i : Cut(r, from, limit);
+				static const char hex[] = "0123456789abcdef";
+				for(size_t k = 0; k < n && r.len < limit; ++k) {
+					const unsigned char c = static_cast<unsigned char>(rest[k]);
+					char e[6] = { char(c) };
+					size_t m = 1;
+					if(c == '"' || c == '\\') { e[0] = '\\'; e[1] = char(c); m = 2; }
+					else if(c == '\n')         { e[0] = '\\'; e[1] = 'n';     m = 2; }
+					else if(c == '\r')         { e[0] = '\\'; e[1] = 'r';     m = 2; }
+					else if(c == '\t')         { e[0] = '\\'; e[1] = 't';     m = 2; }
+					else if(c < 0x20) {
+						e[0] = '\\'; e[1] = 'u'; e[2] = '0'; e[3] = '0'; e[4] = hex[c >> 4]; e[5] = hex[c & 15];
+						m = 6;
+					}
+					if(r.len + m > limit) {
+						if((c & 0xC0) == 0x80) {       // within a UTF-8 sequence: drop its start
+							while(r.len > from && (static_cast<unsigned char>(r.data[r.len - 1]) & 0xC0) == 0x80)
+								--r.len;
+							if(r.len > from && static_cast<unsigned char>(r.data[r.len - 1]) >= 0xC0)
+								--r.len;
+						}
+						break;
+					}
+					std::memcpy(r.data + r.len, e, m);
+					r.len += m;
+				}
+			}
+
+			static void String(Record &r, const char *s, size_t n)
+				// A quoted and escaped string (logfmt: quoted only if needed)
+			{
+				#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+				const bool quote = true;
+				#else
+				bool quote = n == 0;
+				for(size_t i = 0; i < n && !quote; ++i)
+					quote = static_cast<unsigned char>(s[i]) <= ' ' || s[i] == '=' || s[i] == '"' || s[i] == '\\';
+				#endif
+				if(!quote) {
+					r.Append(s, n);
+					return;
+				}
+				r.Put('"');
+				const size_t from = r.len;
+				r.Append(s, n);
+				Escape(r, from, maxLogSize - 2);
+				r.Put('"');
+			}
+
+			static void Number(Record &r, const char *s, size_t n)
+				// Digits as a number, anything else as a string
+			{
+				bool digits = n > 0;
+				for(size_t i = 0; i < n && digits; ++i)
+					digits = s[i] >= '0' && s[i] <= '9';
+				if(digits)
+					r.Append(s, n);
+				else
+					String(r, s, n);
+			}
+
+			static void Number(Record &r, double v) {
+				#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+				if(v != v || v - v != 0) {         // nan, inf: not JSON numbers
+					Literal(r, "null");
+					return;
+				}
+				#endif
+				const int n = std::snprintf(r.data + r.len, r.Room() + 1, "%g", v);     // as in the text
+				if(n > 0) r.len += (size_t(n) > r.Room() ? r.Room() : size_t(n));
+			}
+
+			static void Field(Record &r, const ProcessFields::Field &f, bool number) {
+				const size_t n = f.len - (sizeof(separator) - 1);
+				if(number)
+					Number(r, f.text, n);
+				else
+					String(r, f.text, n);
+			}
+
+			static void AppendFields(Record &r, unsigned fields, long long now, const char *file, const char *fileName,
+			                         const char *func, const char *funcSig, const char *line)
+				// The message prefix, up to the opening quote of the message text
+			{
+				#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+				r.Put('{');
+				#define uLOG_FIELD_END  ","
+				#else
+				#define uLOG_FIELD_END  " "
+				#endif
+
+				char tmp[Timestamp::maxLen];
+				if(fields & MICRO_LOG_FIELD_TIME) {
+					size_t n = Timestamp::FormatElapsed(tmp, now) - 2, i = 0;
+					while(i < n && tmp[i] == ' ') ++i;
+					Literal(r, uLOG_FIELD_KEY("elapsed"));
+					r.Append(tmp + i, n - i);
+					Literal(r, uLOG_FIELD_END);
+				}
+				if(fields & MICRO_LOG_FIELD_DATE) {
+					const size_t n = Timestamp::FormatDate(tmp, now) - 2;
+					tmp[10] = 'T';                 // ISO 8601
+					Literal(r, uLOG_FIELD_KEY("date"));
+					String(r, tmp, n);
+					Literal(r, uLOG_FIELD_END);
+				}
+				if(fields & MICRO_LOG_FIELD_LEVEL) {
+					const char *tag = logLevelTags[r.level];
+					size_t n = sizeof(logLevelTags[0]) - 1;
+					while(n > 0 && tag[n - 1] == ' ') --n;
+					while(n > 0 && *tag == ' ') ++tag, --n;
+					Literal(r, uLOG_FIELD_KEY("level"));
+					String(r, tag, n);
+					Literal(r, uLOG_FIELD_END);
+				}
+				if(fields & (MICRO_LOG_FIELD_EXEC | MICRO_LOG_FIELD_PID | MICRO_LOG_FIELD_UID | MICRO_LOG_FIELD_UNAME)) {
+					ProcessFields::Check();
+					if(fields & MICRO_LOG_FIELD_EXEC) {
+						Literal(r, uLOG_FIELD_KEY("exec"));
+						Field(r, ProcessFields::exec, false);
+						Literal(r, uLOG_FIELD_END);
+					}
+					if(fields & MICRO_LOG_FIELD_PID) {
+						Literal(r, uLOG_FIELD_KEY("pid"));
+						Field(r, ProcessFields::pid, true);
+						Literal(r, uLOG_FIELD_END);
+					}
+					if(fields & MICRO_LOG_FIELD_UID) {
+						Literal(r, uLOG_FIELD_KEY("uid"));
+						Field(r, ProcessFields::uid, true);
+						Literal(r, uLOG_FIELD_END);
+					}
+					if(fields & MICRO_LOG_FIELD_UNAME) {
+						Literal(r, uLOG_FIELD_KEY("user"));
+						Field(r, ProcessFields::uname, false);
+						Literal(r, uLOG_FIELD_END);
+					}
+				}
+				if((fields & MICRO_LOG_FIELD_FILE_NAME) && fileName) {
+					Literal(r, uLOG_FIELD_KEY("file"));
+					String(r, fileName, std::strlen(fileName));
+					Literal(r, uLOG_FIELD_END);
+				}
+				if((fields & MICRO_LOG_FIELD_FILE_PATH) && file) {
+					Literal(r, uLOG_FIELD_KEY("path"));
+					String(r, file, std::strlen(file));
+					Literal(r, uLOG_FIELD_END);
+				}
+				if((fields & MICRO_LOG_FIELD_FUNC_NAME) && func) {
+					Literal(r, uLOG_FIELD_KEY("func"));
+					String(r, func, std::strlen(func));
+					Literal(r, uLOG_FIELD_END);
+				}
+				if((fields & MICRO_LOG_FIELD_FUNC_SIG) && funcSig) {
+					Literal(r, uLOG_FIELD_KEY("sig"));
+					String(r, funcSig, std::strlen(funcSig));
+					Literal(r, uLOG_FIELD_END);
+				}
+				if((fields & MICRO_LOG_FIELD_LINE) && line) {
+					Literal(r, uLOG_FIELD_KEY("line"));
+					Number(r, line, std::strlen(line));
+					Literal(r, uLOG_FIELD_END);
+				}
+				#undef uLOG_FIELD_END
+
+				Literal(r, uLOG_FIELD_KEY("msg") "\"");
+				r.text = r.len;
+				r.kvLen = 0;
+			}
+
+			static void Close(Record &r)
+				// End the message: its text escaped and closed, then the key-values
+			{
+				if(!r.text)
+					return;
+				#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+				const size_t tail = 1 + r.kvLen + 1;      // '"', key-values, '}'
+				#else
+				const size_t tail = 1 + r.kvLen;
+				#endif
+				Escape(r, r.text, maxLogSize - 1 - tail);
+				r.Put('"');
+				r.Append(r.kv, r.kvLen);
+				#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+				r.Put('}');
+				#endif
+				r.text = r.kvLen = 0;
+			}
+
+			// Key-value values (uLOG_KV)
+
+			static void Value(Record &r, bool v) {
+				if(v) Literal(r, "true");
+				else  Literal(r, "false");
+			}
+
+			static void Value(Record &r, char c)               { String(r, &c, 1); }
+			static void Value(Record &r, const char *s)        { if(s) String(r, s, std::strlen(s)); else Literal(r, "null"); }
+			static void Value(Record &r, const std::string &s) { String(r, s.data(), s.size()); }
+
+			template <typename T>
+			static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type Value(Record &r, T v) {
+				r.AppendSigned((long long)v);
+			}
+
+			template <typename T>
+			static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type Value(Record &r, T v) {
+				r.AppendUnsigned((unsigned long long)v);
+			}
+
+			template <typename T>
+			static typename std::enable_if<std::is_floating_point<T>::value>::type Value(Record &r, T v) {
+				Number(r, double(v));
+			}
+
+			template <typename T>
+			static typename std::enable_if<!std::is_arithmetic<T>::value>::type Value(Record &r, const T &v)
+				// Any other type, formatted by operator<< as a string
+			{
+				r.Put('"');
+				const size_t from = r.len;
+				r << v;
+				Escape(r, from, maxLogSize - 2);
+				r.Put('"');
+			}
+		};
+
+		#endif // MICRO_LOG_STRUCTURED
+
+		inline void AppendFields(Record &r, unsigned fields, long long now, const char *file, const char *fileName,
+		                         const char *func, const char *funcSig, const char *line)
+			// The message prefix, with the fields in the fields mask
+		{
+			#ifdef MICRO_LOG_STRUCTURED
+			Structured::AppendFields(r, fields, now, file, fileName, func, funcSig, line);
+			return;
+			#endif
+			if(fields & MICRO_LOG_FIELD_TIME)
+				r.len += Timestamp::FormatElapsed(r.data + r.len, now);
+			if(fields & MICRO_LOG_FIELD_DATE)
+				r.len += Timestamp::FormatDate(r.data + r.len, now);
+			if(fields & MICRO_LOG_FIELD_LEVEL) {
+				r.Append(logLevelTags[r.level]);
+				r.Append(separator);
+			}
+			if(fields & (MICRO_LOG_FIELD_EXEC | MICRO_LOG_FIELD_PID | MICRO_LOG_FIELD_UID | MICRO_LOG_FIELD_UNAME)) {
+				ProcessFields::Check();
+				if(fields & MICRO_LOG_FIELD_EXEC)
+					r.Append(ProcessFields::exec.text, ProcessFields::exec.len);
+				if(fields & MICRO_LOG_FIELD_PID)
+					r.Append(ProcessFields::pid.text, ProcessFields::pid.len);
+				if(fields & MICRO_LOG_FIELD_UID)
+					r.Append(ProcessFields::uid.text, ProcessFields::uid.len);
+				if(fields & MICRO_LOG_FIELD_UNAME)
+					r.Append(ProcessFields::uname.text, ProcessFields::uname.len);
+			}
+			const char *site[] = { fileName, file, func, funcSig, line };
+			const unsigned siteFields[] = { MICRO_LOG_FIELD_FILE_NAME, MICRO_LOG_FIELD_FILE_PATH, MICRO_LOG_FIELD_FUNC_NAME,
+			                                MICRO_LOG_FIELD_FUNC_SIG, MICRO_LOG_FIELD_LINE };
+			for(int i = 0; i < 5; ++i)
+				if(fields & siteFields[i]) {
+					r.Append(site[i]);
+					r.Append(separator);
+				}
+			r.Append(": ", 2);
+		}
+
+
+		#ifdef MICRO_LOG_SINKS
+
+		struct Sink
+			/// A destination of the uLOG messages besides microLog_ofs: a file, a stream (e.g.
+			/// std::cerr), or a ring buffer in memory
+		{
+			std::atomic<int>   minLevel;   // read by Fan() without the lock
+			unsigned           fields;     // MICRO_LOG_FIELD_* mask
+			std::ostream      *stream;     // nullptr: memory
+			std::ofstream      file;
+			std::vector<char>  memory;
+			unsigned long long written;
+
+			Sink() : minLevel(nLogLevels), fields(0), stream(nullptr), written(0) {}
+
+			void Write(const char *data, size_t len)
+				// Caller holds the lock
+			{
+				if(stream) {
+					stream->write(data, std::streamsize(len));
+					stream->flush();
+				}
+				else if(!memory.empty()) {
+					for(size_t done = 0; done < len; ) {
+						const size_t pos = size_t(written % memory.size());
+						const size_t n = len - done < memory.size() - pos ? len - done : memory.size() - pos;
+						std::memcpy(&memory[pos], data + done, n);
+						done += n;
+						written += n;
+					}
+					return;
+				}
+				written += len;
+			}
+
+			std::string Memory() const
+				// Memory sink: the last messages written, the oldest first
+			{
+				if(written <= memory.size())
+					return std::string(memory.begin(), memory.begin() + std::ptrdiff_t(written));
+				const size_t pos = size_t(written % memory.size());
+				return std::string(memory.begin() + std::ptrdiff_t(pos), memory.end()) + std::string(memory.begin(), memory.begin() + std::ptrdiff_t(pos));
+			}
+		};
+
+		struct Sinks
+			/// Registry of the sinks receiving the uLOG messages with their own minimum level and
+			/// fields. microLog_ofs is always the first sink, with uLog::minLogLevel and LogFields;
+			/// it is the only one written through memory mapped segments (MICRO_LOG_MMAP), the
+			/// file sinks are written with std::ofstream.
+			/// Each message is formatted once per distinct set of fields, and the same text is
+			/// written to all the sinks using it. A message wanted by no sink is rejected by
+			/// LevelEnabled(), with the single load of lowestLevel (see UpdateThresholds()).
+		{
+			static Sink             sinks[MICRO_LOG_MAX_SINKS];
+			static std::atomic<int> count;
+
+			// Each returns the sink id, or -1 if there are already MICRO_LOG_MAX_SINKS sinks
+			// (ignored by SetLevel() and Memory())
+
+			static int AddFile(const std::string &fname, int level, unsigned fields = MICRO_LOG_FIELDS_DEFAULT) {
+				return Add(level, fields, nullptr, &fname, 0);
+			}
+
+			static int AddStream(std::ostream &os, int level, unsigned fields = MICRO_LOG_FIELDS_DEFAULT) {
+				return Add(level, fields, &os, nullptr, 0);
+			}
+
+			static int AddMemory(size_t size, int level, unsigned fields = MICRO_LOG_FIELDS_DEFAULT) {
+				return Add(level, fields, nullptr, nullptr, size ? size : maxLogSize);
+			}
+
+			static bool SetLevel(int id, int level) {
+				if(id < 0 || id >= MICRO_LOG_MAX_SINKS || id >= count.load(std::memory_order_acquire))
+					return false;
+				MICRO_LOG_LOCK;
+				sinks[id].minLevel.store(level, std::memory_order_relaxed);
+				UpdateMinLevel();
+				MICRO_LOG_UNLOCK;
+				return true;
+			}
+
+			static std::string Memory(int id) {
+				std::string s;
+				if(id < 0 || id >= MICRO_LOG_MAX_SINKS || id >= count.load(std::memory_order_acquire))
+					return s;
+				MICRO_LOG_LOCK;
+				s = sinks[id].Memory();
+				MICRO_LOG_UNLOCK;
+				return s;
+			}
+
+			static void Clear()
+				// Remove all the sinks (no messages must be logged meanwhile)
+			{
+				const int n = count.exchange(0);
+				minSinkLevel = nLogLevels;
+				UpdateThresholds();
+				for(int i = 0; i < n; ++i) {
+					sinks[i].file.close();
+					sinks[i].stream = nullptr;
+					std::vector<char>().swap(sinks[i].memory);
+					sinks[i].written = 0;
+					sinks[i].minLevel = nLogLevels;
+				}
+			}
+
+			static void Fan(const Record &r)
+				// Write a message to the sinks wanting it, formatting it once per set of fields
+			{
+				static thread_local Record layout;
+				const int n = count.load(std::memory_order_acquire);
+				unsigned done = 0;                            // sinks written
+
+				for(int i = 0; i < n; ++i) {
+					if((done & (1u << i)) || r.level < sinks[i].minLevel.load(std::memory_order_relaxed))
+						continue;
+					const unsigned fields = sinks[i].fields;
+					const char *data = r.data;
+					size_t len = r.len;
+					if(r.body && fields != r.fields) {        // another prefix, the same message
+						layout.len = 0;
+						layout.level = r.level;
+						AppendFields(layout, fields, r.time, r.file, r.fileName, r.func, r.funcSig, r.line);
+						const bool newLine = r.data[r.len - 1] == '\n';
+						layout.Append(r.data + r.body, r.len - r.body - (newLine ? 1 : 0));
+						if(newLine)
+							layout.data[layout.len++] = '\n';
+						data = layout.data;
+						len = layout.len;
+					}
+					MICRO_LOG_LOCK;
+					for(int j = i; j < n; ++j)
+						if(!(done & (1u << j)) && r.level >= sinks[j].minLevel.load(std::memory_order_relaxed) && sinks[j].fields == fields) {
+							sinks[j].Write(data, len);
+							done |= 1u << j;
+						}
+					MICRO_LOG_UNLOCK;
+				}
+			}
+
+		private:
+			static int Add(int level, unsigned fields, std::ostream *os, const std::string *fname, size_t memory)
+			{
+				int id = -1;
+				MICRO_LOG_LOCK;
+				if(count.load(std::memory_order_relaxed) < MICRO_LOG_MAX_SINKS) {
+					id = count.load(std::memory_order_relaxed);
+					Sink &sink = sinks[id];
+					sink.minLevel.store(level, std::memory_order_relaxed);
+					sink.fields = fields;
+					sink.written = 0;
+					sink.stream = os;
+					if(fname) {
+						sink.file.open(*fname, std::fstream::app);
+						sink.stream = &sink.file;
+					}
+					sink.memory.assign(memory, '\0');
+					count.store(id + 1, std::memory_order_release);     // ready to be used by Fan()
+					UpdateMinLevel();
+				}
+				MICRO_LOG_UNLOCK;
+				return id;
+			}
+
+			static void UpdateMinLevel()
+				// Caller holds the lock
+			{
+				int level = nLogLevels;
+				for(int i = 0, n = count.load(); i < n; ++i)
+					if(sinks[i].minLevel.load(std::memory_order_relaxed) < level)
+						level = sinks[i].minLevel.load(std::memory_order_relaxed);
+				minSinkLevel = level;
+				UpdateThresholds();
+			}
+		};
+
+		#endif // MICRO_LOG_SINKS
+
+		#ifdef MICRO_LOG_RECORDER
+
+		struct Recorder
+			/// Flight recorder: the uLOG messages below uLog::minLogLevel, down to the recorder level
+			/// (MICRO_LOG_RECORDER_LEVEL, verbose by default; SetLevel(nLogLevels) stops it), are
+			/// kept in a ring of the thread instead of being written. The rings are written to
+			/// microLog_ofs, merged by time, before each message of the dump level (error by
+			/// default) and by Dump(); on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT they are written
+			/// with write() only, then the previous handler runs. Each message is dumped once.
+			/// Each thread writes its ring without locks; up to MICRO_LOG_RECORDER_THREADS threads
+			/// have a ring (of MICRO_LOG_RECORDER_SIZE bytes), reused after a thread exits.
+		{
+			struct Entry {                               // header of a message in a ring
+				long long time;
+				unsigned  len;
+				int       level;
+			};
+
+			struct Ring {
+				std::atomic<unsigned long long> head, tail;     // end of the messages, start of the oldest one
+				unsigned long long              dumped;         // end of the last dump (under dumping)
+				std::atomic<bool>               owned;
+				char                            data[MICRO_LOG_RECORDER_SIZE];
+			};
+
+			static const int nSignals = 5;
+
+			static Ring                       rings[MICRO_LOG_RECORDER_THREADS];
+			static std::atomic<int>           dumpLevel;
+			static bool                       handleSignals;    // set before uLOG_START
+			static int                        crashFd;          // written on a signal (the log file opened by uLOG_START)
+			static std::atomic_flag           dumping;
+			static struct sigaction           previous[nSignals];
+			static std::atomic<unsigned long> nDumps, nLost;    // lost: threads without a ring
+
+			static void SetLevel(int level) {
+				minRecordLevel = level;
+				UpdateThresholds();
+			}
+
+			static void SetDumpLevel(int level) {
+				dumpLevel = level;
+			}
+
+			static void Add(const Record &r)
+				// Keep a message in the ring of the thread, dropping the oldest ones
+			{
+				Ring *ring = ThisRing();
+				if(!ring) {
+					nLost.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				const Entry e = { Timestamp::Now(), unsigned(r.len), r.level };
+				const unsigned long long head = ring->head.load(std::memory_order_relaxed), end = head + sizeof(e) + r.len;
+				unsigned long long tail = ring->tail.load(std::memory_order_relaxed);
+				if(end - tail > MICRO_LOG_RECORDER_SIZE) {
+					while(end - tail > MICRO_LOG_RECORDER_SIZE) {
+						Entry oldest;
+						Read(*ring, tail, &oldest, sizeof(oldest));
+						tail += sizeof(oldest) + oldest.len;
+					}
+					ring->tail.store(tail, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_release);     // before the oldest are overwritten
+				}
+				Copy(*ring, head, &e, sizeof(e));
+				Copy(*ring, head + sizeof(e), r.data, r.len);
+				ring->head.store(end, std::memory_order_release);
+			}
+
+			static bool Dump()
+				// Write the messages not dumped yet to microLog_ofs; false if there are none
+			{
+				if(dumping.test_and_set(std::memory_order_acquire))
+					return false;                        // another thread is dumping them
+				bool any = false;
+				Merge([&any](const Entry &e, const char *text) {
+					if(!any) {
+						static const char head[] = uLOG_TEXT_LINE("--- Flight recorder ---");
+						Write(&microLog_ofs, e.level, head, sizeof(head) - 1);
+						any = true;
+					}
+					Write(&microLog_ofs, e.level, text, e.len);
+				});
+				if(any) {
+					static const char tail[] = uLOG_TEXT_LINE("--- End of the flight recorder ---");
+					Write(&microLog_ofs, info, tail, sizeof(tail) - 1);
+					nDumps.fetch_add(1, std::memory_order_relaxed);
+				}
+				dumping.clear(std::memory_order_release);
+				return any;
+			}
+
+			static bool Dump(int fd)
+				// Write the messages not dumped yet to fd, with write() only (async-signal-safe)
+			{
+				if(fd < 0 || dumping.test_and_set(std::memory_order_acquire))
+					return false;
+				bool any = false;
+				Merge([fd, &any](const Entry &e, const char *text) {
+					if(!any) {
+						static const char head[] = uLOG_TEXT_LINE("--- Flight recorder ---");
+						WriteAll(fd, head, sizeof(head) - 1);
+						any = true;
+					}
+					WriteAll(fd, text, e.len);
+				});
+				if(any) {
+					static const char tail[] = uLOG_TEXT_LINE("--- End of the flight recorder ---");
+					WriteAll(fd, tail, sizeof(tail) - 1);
+					nDumps.fetch_add(1, std::memory_order_relaxed);
+				}
+				dumping.clear(std::memory_order_release);
+				return any;
+			}
+
+			static void Start()
+				// Open the log file for the dumps on a signal, and install the handlers (once)
+			{
+				if(crashFd >= 0)
+					close(crashFd);
+				#ifdef MICRO_LOG_MMAP
+				const std::string path = logFilename + ".recorder";     // the mapped file ends with preallocated zeros
+				#else
+				const std::string &path = logFilename;
+				#endif
+				crashFd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+				static bool installed = false;
+				if(handleSignals && !installed) {
+					struct sigaction sa = {};
+					sa.sa_handler = &Recorder::OnSignal;
+					sa.sa_flags = SA_ONSTACK;
+					sigemptyset(&sa.sa_mask);
+					for(int i = 0; i < nSignals; ++i)
+						sigaction(Signals()[i], &sa, &previous[i]);
+					installed = true;
+				}
+			}
+
+		private:
+			struct Owner {
+				Ring *ring;
+
+				Owner() : ring(Claim()) {}
+				~Owner() { if(ring) ring->owned.store(false, std::memory_order_release); }
+			};
+
+			static Ring* ThisRing() {
+				static thread_local Owner owner;
+				return owner.ring;
+			}
+
+			static Ring* Claim()
+				// A free ring, with the messages of its previous thread; nullptr if none
+			{
+				for(int i = 0; i < MICRO_LOG_RECORDER_THREADS; ++i) {
+					bool owned = false;
+					if(!rings[i].owned.load(std::memory_order_relaxed) && rings[i].owned.compare_exchange_strong(owned, true))
+						return &rings[i];
+				}
+				return nullptr;
+			}
+
+			static const int* Signals() {
+				static const int signals[nSignals] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+				return signals;
+			}
+
+			static void OnSignal(int signal)
+			{
+				Dump(crashFd);
+				for(int i = 0; i < nSignals; ++i)
+					if(Signals()[i] == signal)
+						sigaction(signal, &previous[i], nullptr);
+				raise(signal);                           // delivered to the previous handler on return
+			}
+
+			static void Copy(Ring &ring, unsigned long long pos, const void *src, size_t n) {
+				const size_t offset = size_t(pos % MICRO_LOG_RECORDER_SIZE), first = std::min(n, MICRO_LOG_RECORDER_SIZE - offset);
+				std::memcpy(ring.data + offset, src, first);
+				std::memcpy(ring.data, static_cast<const char*>(src) + first, n - first);
+			}
+
+			static void Read(const Ring &ring, unsigned long long pos, void *dst, size_t n) {
+				const size_t offset = size_t(pos % MICRO_LOG_RECORDER_SIZE), first = std::min(n, MICRO_LOG_RECORDER_SIZE - offset);
+				std::memcpy(dst, ring.data + offset, first);
+				std::memcpy(static_cast<char*>(dst) + first, ring.data, n - first);
+			}
+
+			static bool Valid(const Ring &ring, unsigned long long pos) {
+				// The bytes read from pos were not overwritten meanwhile
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return ring.tail.load(std::memory_order_relaxed) <= pos;
+			}
+
+			template <class Out>
+			static void Merge(Out out)
+				// The messages not dumped yet, oldest first, to out(entry, text); no allocations
+			{
+				unsigned long long cursor[MICRO_LOG_RECORDER_THREADS], end[MICRO_LOG_RECORDER_THREADS];
+				for(int i = 0; i < MICRO_LOG_RECORDER_THREADS; ++i) {
+					end[i] = rings[i].head.load(std::memory_order_acquire);
+					cursor[i] = std::max(rings[i].tail.load(std::memory_order_relaxed), rings[i].dumped);
+				}
+
+				char text[maxLogSize];
+				for(;;) {
+					int next = -1;
+					Entry first = Entry();
+					for(int i = 0; i < MICRO_LOG_RECORDER_THREADS; ++i) {
+						Entry e;
+						while(cursor[i] < end[i]) {
+							Read(rings[i], cursor[i], &e, sizeof(e));
+							if(!Valid(rings[i], cursor[i]))
+								cursor[i] = rings[i].tail.load(std::memory_order_relaxed);     // overwritten
+							else if(e.len > maxLogSize)
+								cursor[i] = end[i];
+							else
+								break;
+						}
+						if(cursor[i] < end[i] && (next < 0 || e.time < first.time)) {
+							next = i;
+							first = e;
+						}
+					}
+					if(next < 0)
+						break;
+
+					Ring &ring = rings[next];
+					Read(ring, cursor[next] + sizeof(first), text, first.len);
+					if(Valid(ring, cursor[next]))
+						out(first, text);
+					cursor[next] += sizeof(first) + first.len;
+				}
+
+				for(int i = 0; i < MICRO_LOG_RECORDER_THREADS; ++i)
+					rings[i].dumped = std::min(cursor[i], end[i]);
+			}
+
+			static void WriteAll(int fd, const char *data, size_t len) {
+				while(len > 0) {
+					const ssize_t n = write(fd, data, len);
+					if(n < 0 && errno == EINTR)
+						continue;
+					if(n <= 0)
+						return;
+					data += n;
+					len -= size_t(n);
+				}
+			}
+		};
+
+		#endif // MICRO_LOG_RECORDER
+
+		inline void Deliver(Record &r);
+
+		#ifdef MICRO_LOG_COALESCE
+
+		struct Coalescer
+			/// Identical consecutive messages of a uLOG call site (e.g. the same error in a retry
+			/// loop): the first one is written, the next ones within windowMs of the first repeat
+			/// are counted instead, and written as a single summary line, the first repeat followed by
+			/// "(repeated N times from <first> to <last>)".
+			/// Each thread keeps the last message of MICRO_LOG_COALESCE_SITES call sites (by address),
+			/// as the length and a 64 bit hash of its text after the fields; a message costs the hash
+			/// of its text, and a clock read only while a repeat is pending.
+			/// The summary is written by the next different message of the call site, by the next
+			/// message of the thread once the window has elapsed, by Flush() and at thread exit.
+		{
+			static std::atomic<int> windowMs;          // 0: nothing coalesced
+
+			static void SetWindow(int ms) {
+				windowMs.store(ms, std::memory_order_relaxed);
+			}
+
+			static Record& At(Record &r, const char *file, unsigned line)
+				// Called by uLOG after the fields
+			{
+				r.body = r.len;
+				r.site = ((unsigned long long)reinterpret_cast<size_t>(file) ^ ((unsigned long long)line << 48)) | 1;
+				return r;
+			}
+
+			static bool Pass(Record &r)
+				// false: r repeats the previous message of its call site, and is counted instead
+			{
+				#ifdef MICRO_LOG_RECORDER
+				if(!r.toTarget && r.target == &microLog_ofs)        // for the recorder
+					return true;
+				#endif
+				State &s = Local();
+				const long long window = windowMs.load(std::memory_order_relaxed) * 1000000LL;
+				if(window <= 0) {
+					if(s.pending)
+						Flush(s);
+					return true;
+				}
+
+				const size_t len = r.len - r.body;
+				const unsigned long long hash = Hash(r.data + r.body, len);
+				Entry &e = s.entries[(r.site ^ (r.site >> 32)) % MICRO_LOG_COALESCE_SITES];
+
+				long long now = 0;
+				if(s.pending) {                // summaries of the elapsed windows
+					now = Timestamp::Now();
+					for(int i = 0; i < MICRO_LOG_COALESCE_SITES; ++i)
+						if(s.entries[i].count && now - s.entries[i].first >= window)
+							Summary(s, s.entries[i]);
+				}
+
+				if(e.site == r.site && e.hash == hash && e.len == len) {
+					if(!now)
+						now = Timestamp::Now();
+					if(e.count++ == 0) {
+						e.first = now;
+						e.record = r;
+						++s.pending;
+					}
+					e.last = now;
+					return false;
+				}
+
+				if(e.count)
+					Summary(s, e);
+				e.site = r.site;
+				e.hash = hash;
+				e.len = len;
+				return true;
+			}
+
+			static void Flush() {
+				// Write the summaries of the calling thread
+				Flush(Local());
+			}
+
+			static unsigned long long Hash(const char *p, size_t n)
+				// 8 bytes per multiply
+			{
+				const unsigned long long k = 0x9E3779B97F4A7C15ULL;
+				unsigned long long h = n * k, w;
+				for(; n >= 8; p += 8, n -= 8) {
+					std::memcpy(&w, p, 8);
+					h = (h ^ w) * k;
+					h ^= h >> 29;
+				}
+				if(n) {
+					w = 0;
+					std::memcpy(&w, p, n);
+					h = (h ^ w) * k;
+				}
+				return h ^ (h >> 32);
+			}
+
+		private:
+			struct Entry {
+				unsigned long long site, hash, count;       // count: repeats not written
+				size_t             len;
+				long long          first, last;             // times of the first and last repeat
+				Record             record;                  // the first repeat
+			};
+
+			struct State {
+				Entry entries[MICRO_LOG_COALESCE_SITES];
+				int   pending;                              // entries with repeats
+
+				~State() {
+					if(loggerStatus == 0)
+						Flush(*this);
+				}
+			};
+
+			static State& Local() {
+				static thread_local State state;
+				return state;
+			}
+
+			static void Flush(State &s) {
+				for(int i = 0; i < MICRO_LOG_COALESCE_SITES && s.pending; ++i)
+					if(s.entries[i].count)
+						Summary(s, s.entries[i]);
+			}
+
+			static void Summary(State &s, Entry &e)
+				// Write the repeats of e: a single one as it is
+			{
+				Record &r = e.record;
+				if(e.count > 1) {
+					#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+					const char repeated[] = ",\"repeated\":", times[] = ",\"first\":\"", to[] = "\",\"last\":\"", end[] = "\"}";
+					#elif defined(MICRO_LOG_STRUCTURED)
+					const char repeated[] = " repeated=", times[] = " first=", to[] = " last=", end[] = "";
+					#else
+					const char repeated[] = " (repeated ", times[] = " times from ", to[] = " to ", end[] = ")";
+					#endif
+					char note[160];
+					size_t n = 0;
+					std::memcpy(note + n, repeated, sizeof(repeated) - 1);  n += sizeof(repeated) - 1;
+					char digits[24];
+					char *d = digits + sizeof(digits);
+					unsigned long long c = e.count;
+					do { *--d = char('0' + c % 10); c /= 10; } while(c);
+					std::memcpy(note + n, d, size_t(digits + sizeof(digits) - d));  n += size_t(digits + sizeof(digits) - d);
+					const long long when[2] = { e.first, e.last };
+					for(int i = 0; i < 2; ++i) {
+						if(i == 0) { std::memcpy(note + n, times, sizeof(times) - 1);  n += sizeof(times) - 1; }
+						else       { std::memcpy(note + n, to, sizeof(to) - 1);  n += sizeof(to) - 1; }
+						const size_t date = n;
+						n += Timestamp::FormatDate(note + n, when[i]) - 2;     // without the trailing spaces
+						#ifdef MICRO_LOG_STRUCTURED
+						note[date + 10] = 'T';                                 // ISO 8601, as the date field
+						#else
+						(void)date;
+						#endif
+					}
+					std::memcpy(note + n, end, sizeof(end) - 1);  n += sizeof(end) - 1;
+
+					const bool newLine = r.len > r.body && r.data[r.len - 1] == '\n';
+					if(newLine)
+						--r.len;
+					#ifdef MICRO_LOG_STRUCTURED                 // whole, or not at all
+					#if MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+					const bool closed = r.len > r.body && r.data[r.len - 1] == '}';
+					if(closed)
+						--r.len;
+					#else
+					const bool closed = false;
+					#endif
+					if(r.len + n <= maxLogSize - 1)
+						r.Append(note, n);
+					else if(closed)
+						r.Put('}');
+					#else
+					if(r.len + n > maxLogSize - 1)
+						r.len = maxLogSize - 1 - n > r.body ? maxLogSize - 1 - n : r.body;
+					r.Append(note, n);
+					#endif
+					if(newLine)
+						r.data[r.len++] = '\n';
+				}
+				e.count = 0;
+				--s.pending;
+				r.site = 0;
+				Deliver(r);
+			}
+		};
+
+		#endif // MICRO_LOG_COALESCE
+
+		inline void Commit(Record &r)
+			// Write the message to its stream
+		{
+			#ifndef MICRO_LOG_DLL
+			if(r.start) {
+				const long long formatted = Statistics::Clock();
+				Deliver(r);
+				Statistics::Latency(formatted - r.start, Statistics::Clock() - formatted);
+				r.start = 0;                  // anything logged after a std::flush: not measured
+				return;
+			}
+			#endif
+			Deliver(r);
+		}
+
+		inline void Deliver(Record &r)
+		{
+			#ifdef MICRO_LOG_BINARY
+			if(r.framed) {
+				if(!r.binary && r.len == BinaryLog::textHead)      // empty text
+					return;
+				BinaryLog::SetLength(r.data, r.len);
+				Write(r.target, r.level, r.data, r.len);
+				BeginText(r);          // anything logged after a std::flush
+				return;
+			}
+			#endif
+
+			if(r.len == 0)
+				return;
+
+			#ifdef MICRO_LOG_COALESCE
+			if(r.site) {
+				const bool pass = Coalescer::Pass(r);
+				r.site = 0;                   // anything logged after a std::flush: not coalesced
+				if(!pass) {
+					r.len = r.body = 0;
+					return;
+				}
+			}
+			#endif
+
+			#ifdef MICRO_LOG_RECORDER
+			if(r.target == &microLog_ofs) {
+				if(!r.toTarget)
+					Recorder::Add(r);
+				else if(r.level >= Recorder::dumpLevel.load(std::memory_order_relaxed))
+					Recorder::Dump();         // the context before the message
+			}
+			#endif
+
+			#ifdef MICRO_LOG_SINKS
+			if(r.target == &microLog_ofs && Sinks::count.load(std::memory_order_relaxed) > 0) {
+				if(r.toTarget)
+					Write(r.target, r.level, r.data, r.len);
+				Sinks::Fan(r);
+				r.len = r.body = 0;           // anything logged after a std::flush: no prefix
+				return;
+			}
+			#endif
+
+			#ifdef MICRO_LOG_RECORDER
+			if(r.toTarget)                    // otherwise kept by the recorder
+				Write(r.target, r.level, r.data, r.len);
+			#else
+			Write(r.target, r.level, r.data, r.len);
+			#endif
+			r.len = 0;
+		}
+
+		inline void ResetFormat(Record &r)
+			// Default format of the stream formatting the record, if a manipulator changed it
+		{
+			if(r.formatted) {
+				std::ostream &os = FormatStream();
+				os.flags(std::ios_base::dec | std::ios_base::skipws);
+				os.precision(6);
+				os.width(0);
+				os.fill(' ');
+				r.formatted = false;
+			}
+		}
+
+		inline Record& BeginRecord(std::ostream &target, int level)
+			// Start a new message, without fields
+		{
+			Record &r = PushRecord();
+			r.len = 0;
+			r.level = level;
+			r.target = &target;
+			#ifndef MICRO_LOG_DLL
+			r.start = Statistics::latency ? Statistics::Clock() : 0;
+			#endif
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			r.toTarget = true;
+			#endif
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_COALESCE)
+			r.body = 0;
+			#endif
+			#ifdef MICRO_LOG_COALESCE
+			r.site = 0;
+			#endif
+			#ifdef MICRO_LOG_STRUCTURED
+			r.text = r.kvLen = 0;
+			#endif
+			ResetFormat(r);
+			#ifdef MICRO_LOG_BINARY
+			if(&target == &microLog_ofs)
+				BeginText(r);
+			else
+				r.framed = r.binary = false;
+			#endif
+			return r;
+		}
+
+		inline Record& BeginLine(std::ostream &target, int level)
+			// Start a message without fields for the log's own lines (titles, dates, statistics)
+		{
+			Record &r = BeginRecord(target, level);
+			#ifdef MICRO_LOG_STRUCTURED
+			Structured::AppendFields(r, 0, 0, nullptr, nullptr, nullptr, nullptr, nullptr);
+			#endif
+			return r;
+		}
+
+		#ifndef WIN32
+
+		inline Record& BeginFileRecord(int level)
+			// Start a uLOGF message, with date and level, written by FileCache::Write()
+		{
+			Record &r = PushRecord();
+			r.level = level;
+			r.target = nullptr;
+			r.start = 0;
+			#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			r.toTarget = true;
+			#endif
+			#ifdef MICRO_LOG_SINKS
+			r.body = 0;
+			#endif
+			#ifdef MICRO_LOG_BINARY
+			r.framed = r.binary = false;
+			#endif
+			ResetFormat(r);
+			#ifdef MICRO_LOG_STRUCTURED
+			r.len = 0;
+			Structured::AppendFields(r, MICRO_LOG_FIELD_DATE | MICRO_LOG_FIELD_LEVEL, Timestamp::Now(),
+			                         nullptr, nullptr, nullptr, nullptr, nullptr);
+			#else
+			r.len = Timestamp::FormatDate(r.data, Timestamp::Now());
+			r.Append(logLevelTags[level], sizeof(logLevelTags[0]) - 1);
+			r.Append(separator);
+			#endif
+			return r;
+		}
+
+		struct FileCache
+			/// Append descriptors of the uLOGF files, kept open: a message costs a single write()
+			/// on an O_APPEND descriptor, which keeps the lines whole without a lock. Up to
+			/// MICRO_LOG_FILE_CACHE_SIZE files stay open, the least recently used one is closed
+			/// to open another; a short spin lock only guards the table. The available space is
+			/// checked every MICRO_LOG_SPACE_CHECK_INTERVAL bytes per file.
+			/// No static members: it works without uLOG_INIT.
+		{
+			struct Entry {
+				std::string        path;
+				int                fd;
+				int                users;        // writers of fd: not closed meanwhile
+				unsigned long long lastUse, unchecked;
+				bool               spaceOk;
+
+				Entry() : fd(-1), users(0), lastUse(0), unchecked(0), spaceOk(true) {}
+			};
+
+			static Entry* Entries() {
+				static Entry entries[MICRO_LOG_FILE_CACHE_SIZE];
+				return entries;
+			}
+
+			static bool Write(const std::string &path, Record &r)
+				// Write the message, with its final new line; false if it is dropped
+			{
+				const bool written = Append(path, r);
+				EndRecord();
+				return written;
+			}
+
+			static bool Append(const std::string &path, Record &r)
+			{
+				#ifdef MICRO_LOG_STRUCTURED
+				Structured::Close(r);
+				#endif
+				r.data[r.len++] = '\n';
+
+				Lock();
+				Entry *entries = Entries(), *e = nullptr, *victim = nullptr;
+				for(int i = 0; i < MICRO_LOG_FILE_CACHE_SIZE && !e; ++i) {
+					if(entries[i].fd >= 0 && entries[i].path == path)
+						e = &entries[i];
+					else if(entries[i].users == 0 && (!victim || entries[i].lastUse < victim->lastUse))
+						victim = &entries[i];         // free, or least recently used
+				}
+				if(!e && victim) {
+					if(victim->fd >= 0)
+						close(victim->fd);
+					victim->fd = Open(path);
+					victim->path = path;
+					victim->unchecked = MICRO_LOG_SPACE_CHECK_INTERVAL;     // checked at once
+					victim->spaceOk = true;
+					if(victim->fd >= 0)
+						e = victim;
+				}
+				int fd = -1;
+				bool check = true, spaceOk = true;
+				if(e) {
+					++e->users;
+					e->lastUse = ++Clock();
+					e->unchecked += r.len;
+					check = e->unchecked >= MICRO_LOG_SPACE_CHECK_INTERVAL;
+					if(check)
+						e->unchecked = 0;
+					spaceOk = e->spaceOk;
+					fd = e->fd;
+				}
+				Unlock();
+
+				if(!e)                                // all the files in use: not cached
+					fd = Open(path);
+				if(fd < 0)
+					return false;
+				if(check)
+					spaceOk = CheckAvailableSpace(path);
+				bool written = false;
+				if(spaceOk) {
+					ssize_t n;
+					while((n = write(fd, r.data, r.len)) < 0 && errno == EINTR) {}
+					written = n == ssize_t(r.len);
+				}
+
+				if(!e)
+					close(fd);
+				else {
+					Lock();
+					if(check)
+						e->spaceOk = spaceOk;
+					--e->users;
+					Unlock();
+				}
+				return written;
+			}
+
+			static void Close()
+				// Close the files not in use (e.g. before they are moved)
+			{
+				Lock();
+				Entry *entries = Entries();
+				for(int i = 0; i < MICRO_LOG_FILE_CACHE_SIZE; ++i)
+					if(entries[i].fd >= 0 && entries[i].users == 0) {
+						close(entries[i].fd);
+						entries[i].fd = -1;
+						entries[i].lastUse = 0;
+					}
+				Unlock();
+			}
+
+		private:
+			static int Open(const std::string &path) {
+				return open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+			}
+
+			static unsigned long long& Clock() {      // use counter, for the LRU order (under the lock)
+				static unsigned long long clock = 0;
+				return clock;
+			}
+
+			static std::atomic_flag& Guard() {
+				static std::atomic_flag guard = ATOMIC_FLAG_INIT;
+				return guard;
+			}
+
+			static void Lock() {
+				while(Guard().test_and_set(std::memory_order_acquire))
+					sched_yield();
+			}
+
+			static void Unlock() {
+				Guard().clear(std::memory_order_release);
+			}
+		};
+
+		#endif // WIN32
+
+		// Insertion operators: common types are formatted directly in the record,
+		// everything else through a std::ostream writing into it.
+		// Binary mode: the common types are stored raw, everything else (or after a
+		// manipulator) as a string.
+
+		#ifdef MICRO_LOG_BINARY
+			template <typename T>
+			inline Record& FormatArg(Record &r, const T &x) {
+				const size_t start = r.BeginStringArg();
+				if(start) {
+					FormatStream() << x;
+					r.EndStringArg(start);
+				}
+				return r;
+			}
+
+			#define uLOG_BINARY_ARG(x, ...)  if(r.binary) return r.formatted ? FormatArg(r, x) : r.PutArg(__VA_ARGS__);
+		#else
+			#define uLOG_BINARY_ARG(x, ...)
+		#endif
+
+		template <typename T>
+		inline Record& operator<<(Record &r, const T &x) {
+			#ifdef MICRO_LOG_BINARY
+			if(r.binary) {
+				r.formatted = true;      // x may have changed the stream format
+				return FormatArg(r, x);
+			}
+			#endif
+			FormatStream() << x;
+			r.formatted = true;      // x may have changed the stream format (e.g. std::setw)
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, const char *s) {
+			uLOG_BINARY_ARG(s, s, s ? std::strlen(s) : 0)
+			if(r.formatted) FormatStream() << s;
+			else r.Append(s);
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, char *s) {
+			return r << (const char*)s;
+		}
+
+		inline Record& operator<<(Record &r, const std::string &s) {
+			uLOG_BINARY_ARG(s, s.data(), s.size())
+			if(r.formatted) FormatStream() << s;
+			else r.Append(s.data(), s.size());
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, char c) {
+			uLOG_BINARY_ARG(c, BinaryLog::argChar, c)
+			if(r.formatted) FormatStream() << c;
+			else r.Put(c);
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, signed char c)   { return r << char(c); }
+		inline Record& operator<<(Record &r, unsigned char c) { return r << char(c); }
+
+		inline Record& operator<<(Record &r, bool b) {
+			uLOG_BINARY_ARG(b, BinaryLog::argBool, b)
+			if(r.formatted) FormatStream() << b;
+			else r.Put(b ? '1' : '0');
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, long long v) {
+			uLOG_BINARY_ARG(v, BinaryLog::argSigned, v)
+			if(r.formatted) FormatStream() << v;
+			else r.AppendSigned(v);
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, unsigned long long v) {
+			uLOG_BINARY_ARG(v, BinaryLog::argUnsigned, v)
+			if(r.formatted) FormatStream() << v;
+			else r.AppendUnsigned(v);
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, short v)          { return r << (long long)v; }
+		inline Record& operator<<(Record &r, int v)            { return r << (long long)v; }
+		inline Record& operator<<(Record &r, long v)           { return r << (long long)v; }
+		inline Record& operator<<(Record &r, unsigned short v) { return r << (unsigned long long)v; }
+		inline Record& operator<<(Record &r, unsigned v)       { return r << (unsigned long long)v; }
+		inline Record& operator<<(Record &r, unsigned long v)  { return r << (unsigned long long)v; }
+
+		inline Record& operator<<(Record &r, double v) {
+			uLOG_BINARY_ARG(v, BinaryLog::argDouble, v)
+			if(r.formatted) {
+				FormatStream() << v;
+			}
+			else {
+				int n = std::snprintf(r.data + r.len, r.Room() + 1, "%g", v);    // same as std::ostream default
+				if(n > 0) r.len += (size_t(n) > r.Room() ? r.Room() : size_t(n));
+			}
+			return r;
+		}
+
+		inline Record& operator<<(Record &r, float v) { return r << double(v); }
+
+		inline Record& operator<<(Record &r, std::ostream& (*f)(std::ostream&))
+			// uLOGE and std::endl terminate the message, std::flush writes it as it is
+		{
+			if(f == &uLog::endm<char, std::char_traits<char> > || f == &std::endl<char, std::char_traits<char> >) {
+				#ifdef MICRO_LOG_STRUCTURED
+				Structured::Close(r);
+				#endif
+				if(!r.binary)          // binary messages: added by the decoder
+					r.data[r.len++] = '\n';
+				Commit(r);
+				EndRecord();
+			}
+			else if(f == &std::flush<char, std::char_traits<char> >) {
+				#ifdef MICRO_LOG_STRUCTURED
+				if(r.text) {           // a structured message is always a whole line
+					Structured::Close(r);
+					r.data[r.len++] = '\n';
+				}
+				#endif
+				Commit(r);
+			}
+			else
+				f(FormatStream());
+			return r;
+		}
+
+		inline void EndLine(Record &r)
+			// End a message which already ends with its new line (uLOG_DATE)
+		{
+			r << std::flush;
+			EndRecord();
+		}
+
+		inline Record& operator<<(Record &r, std::ios_base& (*f)(std::ios_base&)) {
+			f(FormatStream());
+			r.formatted = true;
+			return r;
+		}
+
+		struct Format
+			/// uLOGFMT(level, "x={} y={:.3f}", x, y): the format string is checked at compile time
+			/// (placeholders, specs, number of arguments, and types against d/x/X/b, f/e/g, s);
+			/// the arguments are formatted straight into the record, without std::ostream.
+			/// Spec: {[:][<|>][0][width][.precision][type]}; "{{" and "}}" are literal braces.
+			/// Note: the format is walked by recursive constexpr functions, so its length is limited
+			///       by the compiler's constexpr depth (512 by default).
+		{
+			enum { any = 0, integer = 1, floating = 2, string = 3, maxArgs = 16 };
+
+			// Compile time: -1 if the format string is invalid
+
+			static constexpr bool Digit(char c) {
+				return c >= '0' && c <= '9';
+			}
+
+			static constexpr int Kind(char type) {
+				return type == 'd' || type == 'x' || type == 'X' || type == 'b' ? integer :
+				       type == 'f' || type == 'e' || type == 'g'                 ? floating :
+				       type == 's'                                               ? string : any;
+			}
+
+			static constexpr int SpecEnd(const char *f, int i, int state) {
+				// Index of the '}' closing a spec; state: 0 align, 1 width, 2 precision, 3 type
+				return f[i] == '}'                                          ? i :
+				       state == 0 && (f[i] == '<' || f[i] == '>')           ? SpecEnd(f, i + 1, 1) :
+				       state <= 1 && Digit(f[i])                            ? SpecEnd(f, i + 1, 1) :
+				       state <= 1 && f[i] == '.' && Digit(f[i + 1])         ? SpecEnd(f, i + 1, 2) :
+				       state == 2 && Digit(f[i])                            ? SpecEnd(f, i + 1, 2) :
+				       state <= 2 && Kind(f[i]) != any                      ? SpecEnd(f, i + 1, 3) : -1;
+			}
+
+			static constexpr int Close(const char *f, int i) {
+				// Index of the '}' closing the placeholder at i
+				return f[i + 1] == '}' ? i + 1 : f[i + 1] == ':' ? SpecEnd(f, i + 2, 0) : -1;
+			}
+
+			static constexpr bool Escaped(const char *f, int i) {
+				return (f[i] == '{' && f[i + 1] == '{') || (f[i] == '}' && f[i + 1] == '}');
+			}
+
+			static constexpr int Count(const char *f, int i = 0, int n = 0) {
+				// Number of placeholders
+				return f[i] == 0     ? n :
+				       Escaped(f, i) ? Count(f, i + 2, n) :
+				       f[i] == '}'   ? -1 :
+				       f[i] == '{'   ? (Close(f, i) < 0 ? -1 : Count(f, Close(f, i) + 1, n + 1)) :
+				                       Count(f, i + 1, n);
+			}
+
+			static constexpr unsigned long long Kinds(const char *f, int i = 0, int shift = 0) {
+				// Kind of each placeholder, 4 bits each
+				return f[i] == 0 || shift >= 64 ? 0ULL :
+				       Escaped(f, i) ? Kinds(f, i + 2, shift) :
+				       f[i] == '{'   ? (Close(f, i) < 0 ? 0ULL :
+				                        (((unsigned long long)Kind(f[Close(f, i) - 1]) << shift) | Kinds(f, Close(f, i) + 1, shift + 4))) :
+				                       Kinds(f, i + 1, shift);
+			}
+
+			template <int kind, typename T>
+			struct Fits {
+				typedef typename std::decay<T>::type D;
+				static const bool value = kind == any ||
+				                          (kind == integer  && std::is_integral<D>::value) ||
+				                          (kind == floating && std::is_floating_point<D>::value) ||
+				                          (kind == string   && (std::is_same<D, std::string>::value || std::is_convertible<D, const char*>::value));
+			};
+
+			template <unsigned long long kinds, typename... Ts>
+			struct Fit {
+				static const bool value = true;
+			};
+
+			template <unsigned long long kinds, typename T, typename... Ts>
+			struct Fit<kinds, T, Ts...> {
+				static const bool value = Fits<int(kinds & 15), T>::value && Fit<(kinds >> 4), Ts...>::value;
+			};
+
+			// Run time
+
+			struct Spec {
+				char align, fill, type;
+				int  width, precision;
+			};
+
+			template <size_t... i> struct Indices {};
+			template <size_t n, size_t... i> struct MakeIndices : MakeIndices<n - 1, n - 1, i...> {};
+			template <size_t... i> struct MakeIndices<0, i...> { typedef Indices<i...> type; };
+
+			template <typename... Ts>
+			struct Message {
+				const char *format;
+				std::tuple<const Ts&...> args;
+
+				Message(const char *_format, const Ts&... _args) : format(_format), args(_args...) {}
+
+				void Put(Record &r) const {
+					Apply(r, typename MakeIndices<sizeof...(Ts)>::type());
+				}
+
+				template <size_t... i>
+				void Apply(Record &r, Indices<i...>) const {
+					Format::Put(r, format, std::get<i>(args)...);
+				}
+			};
+
+			template <int n, unsigned long long kinds, typename... Ts>
+			static Message<Ts...> Make(const char *format, const Ts&... args)
+				// Called by uLOGFMT, with n and kinds computed from the format string literal
+			{
+				static_assert(n >= 0, "uLOGFMT: invalid format string");
+				static_assert(n <= maxArgs, "uLOGFMT: too many arguments");
+				static_assert(n == int(sizeof...(Ts)), "uLOGFMT: the number of arguments does not match the format string");
+				static_assert(Fit<kinds, Ts...>::value, "uLOGFMT: an argument does not match the type of its placeholder");
+				return Message<Ts...>(format, args...);
+			}
+
+			static void Put(Record &r, const char *f) {
+				Text(r, f);
+			}
+
+			template <typename T, typename... Ts>
+			static void Put(Record &r, const char *f, const T &x, const Ts&... xs) {
+				Spec s;
+				f = Parse(Text(r, f), s);
+				const size_t start = r.len;
+				Arg(r, s, x);
+				if(size_t(s.width) > r.len - start) {
+					if(!s.align)
+						s.align = std::is_arithmetic<T>::value ? '>' : '<';
+					Pad(r, start, s);
+				}
+				Put(r, f, xs...);
+			}
+
+		private:
+			static const char* Text(Record &r, const char *f)
+				// Copy the text up to the next placeholder; returns it, or the end of f
+			{
+				for(;;) {
+					const char *s = f;
+					while(*f && *f != '{' && *f != '}')
+						++f;
+					r.Append(s, size_t(f - s));
+					if(*f == 0 || (*f == '{' && f[1] != '{'))
+						return f;
+					r.Put(*f);                  // "{{" or "}}"
+					f += 2;
+				}
+			}
+
+			static const char* Parse(const char *f, Spec &s)
+				// The spec of the placeholder at f (already checked); returns the text after it
+			{
+				s.align = s.type = 0;
+				s.fill = ' ';
+				s.width = 0;
+				s.precision = -1;
+				if(*++f == ':') {
+					++f;
+					if(*f == '<' || *f == '>')
+						s.align = *f++;
+					if(*f == '0') {
+						s.fill = '0';
+						++f;
+					}
+					while(Digit(*f))
+						s.width = s.width * 10 + (*f++ - '0');
+					if(*f == '.')
+						for(s.precision = 0; Digit(*++f); )
+							s.precision = s.precision * 10 + (*f - '0');
+					if(*f != '}')
+						s.type = *f++;
+				}
+				return f + 1;
+			}
+
+			static void Pad(Record &r, size_t start, const Spec &s)
+				// Pad the argument formatted from start to its width
+			{
+				size_t pad = size_t(s.width) - (r.len - start);
+				if(pad > r.Room())
+					pad = r.Room();
+				if(s.align == '<') {
+					std::memset(r.data + r.len, s.fill, pad);
+				}
+				else {
+					if(s.fill == '0' && r.data[start] == '-')
+						++start;                    // zeros after the sign
+					std::memmove(r.data + start + pad, r.data + start, r.len - start);
+					std::memset(r.data + start, s.fill, pad);
+				}
+				r.len += pad;
+			}
+
+			template <typename T>
+			static typename std::enable_if<std::is_integral<T>::value>::type Arg(Record &r, const Spec &s, T v) {
+				if(s.type == 'x' || s.type == 'X' || s.type == 'b')
+					Radix(r, v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v, v < 0, s.type);
+				else if(s.type != 'd' && (std::is_same<T, bool>::value || sizeof(T) == 1))
+					r << v;                         // as uLOG: characters, 0/1
+				else if(v < 0)
+					r.AppendSigned((long long)v);
+				else
+					r.AppendUnsigned((unsigned long long)v);
+			}
+
+			template <typename T>
+			static typename std::enable_if<std::is_floating_point<T>::value>::type Arg(Record &r, const Spec &s, T v) {
+				if(s.type == 'f' ? Fixed(r, double(v), s.precision < 0 ? 6 : s.precision) :
+				   s.type == 0 && s.precision < 0 ? General(r, double(v)) : false)
+					return;
+				const char *conversion = s.type == 'f' ? "%.*f" : s.type == 'e' ? "%.*e" : "%.*g";
+				const int n = std::snprintf(r.data + r.len, r.Room() + 1, conversion, s.precision < 0 ? 6 : s.precision, double(v));
+				if(n > 0) r.len += (size_t(n) > r.Room() ? r.Room() : size_t(n));
+			}
+
+			static void Arg(Record &r, const Spec &s, const char *v) {
+				if(v)
+					r.Append(v, s.precision < 0 ? std::strlen(v) : Length(v, size_t(s.precision)));
+			}
+
+			static void Arg(Record &r, const Spec &s, const std::string &v) {
+				r.Append(v.data(), s.precision < 0 || size_t(s.precision) > v.size() ? v.size() : size_t(s.precision));
+			}
+
+			template <typename T>
+			static typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_convertible<const T&, const char*>::value>::type
+			Arg(Record &r, const Spec &, const T &v) {
+				r << v;                             // through std::ostream
+			}
+
+			static size_t Length(const char *s, size_t max) {
+				size_t n = 0;
+				while(n < max && s[n]) ++n;
+				return n;
+			}
+
+			static void Radix(Record &r, unsigned long long v, bool negative, char type) {
+				const char *digits = type == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+				const unsigned base = type == 'b' ? 2 : 16;
+				char tmp[66];
+				char *p = tmp + sizeof(tmp);
+				do { *--p = digits[v % base]; v /= base; } while(v);
+				if(negative) *--p = '-';
+				r.Append(p, size_t(tmp + sizeof(tmp) - p));
+			}
+
+			static unsigned long long Pow10(int n) {
+				unsigned long long p = 1;
+				while(n-- > 0) p *= 10;
+				return p;
+			}
+
+			static unsigned long long Scale(double a, unsigned long long p)
+				// a * p (p: a power of 10 up to 10^9) rounded to the nearest integer, ties to even, as printf:
+				// the fraction of a is scaled alone, and the exact product checked with fma() near a tie
+			{
+				const unsigned long long i = (unsigned long long)a;
+				const double fraction = a - double(i), x = fraction * double(p);
+				unsigned long long u = (unsigned long long)x;
+				const double d = x - double(u) - 0.5;
+				const double exact = std::fabs(d) < 1e-6 ? d + std::fma(fraction, double(p), -x) : d;
+				u += i * p;
+				if(exact > 0 || (exact == 0 && (u & 1)))
+					++u;
+				return u;
+			}
+
+			static void Digits(Record &r, unsigned long long v, int n) {
+				// v with n digits, leading zeros included
+				char tmp[24];
+				for(int i = n; i-- > 0; v /= 10)
+					tmp[i] = char('0' + v % 10);
+				r.Append(tmp, size_t(n));
+			}
+
+			static bool Fixed(Record &r, double v, int precision)
+				// "%.*f" without printf, when v * 10^precision fits 63 bits; false otherwise
+			{
+				const double a = std::fabs(v);
+				if(precision > 9 || !(a * double(Pow10(precision)) < 9e18))     // also NaN and infinity
+					return false;
+				const unsigned long long p = Pow10(precision), u = Scale(a, p);
+				if(std::signbit(v))
+					r.Put('-');
+				r.AppendUnsigned(u / p);
+				if(precision) {
+					r.Put('.');
+					Digits(r, u % p, precision);
+				}
+				return true;
+			}
+
+			static bool General(Record &r, double v)
+				// "%g" without printf, for 1e-4 <= |v| < 1e6 (and 0); false otherwise
+			{
+				const double a = std::fabs(v);
+				if(a == 0) {
+					r.Append(std::signbit(v) ? "-0" : "0");
+					return true;
+				}
+				if(!(a >= 1e-4 && a < 1e6))
+					return false;
+				static const double decades[] = { 1e-4, 1e-3, 1e-2, 1e-1, 1, 1e1, 1e2, 1e3, 1e4, 1e5 };
+				int exponent = 5;                   // 10^exponent <= a
+				while(a < decades[exponent + 4])
+					--exponent;
+				int precision = 5 - exponent;       // 6 significant digits
+				const unsigned long long p = Pow10(precision), u = Scale(a, p);
+				if(u >= 1000000)
+					return false;                   // rounded up to the next decade
+				unsigned long long fraction = u % p;
+				while(precision && fraction % 10 == 0) {
+					fraction /= 10;
+					--precision;
+				}
+				if(std::signbit(v))
+					r.Put('-');
+				r.AppendUnsigned(u / p);
+				if(precision) {
+					r.Put('.');
+					Digits(r, fraction, precision);
+				}
+				return true;
+			}
+		};
+
+		template <typename... Ts>
+		inline Record& operator<<(Record &r, const Format::Message<Ts...> &m) {
+			#ifdef MICRO_LOG_BINARY
+			if(r.binary) {                      // the whole message as a string argument
+				const size_t start = r.BeginStringArg();
+				if(start) {
+					r.binary = false;
+					m.Put(r);
+					r.binary = true;
+					r.EndStringArg(start);
+				}
+				return r;
+			}
+			#endif
+			m.Put(r);
+			return r;
+		}
+
+		template <typename T>
+		struct KeyValue
+			/// uLOG_KV(name, value): a key encoded at compile time, and a value
+		{
+			const char *key;
+			size_t      keyLen;
+			const T    &value;
+		};
+
+		template <typename T>
+		inline KeyValue<T> KV(const char *key, size_t keyLen, const T &value) {
+			return KeyValue<T>{ key, keyLen, value };
+		}
+
+		#define uLOG_KV(name, value)  uLog::KV(uLOG_KEY(name), sizeof(uLOG_KEY(name)) - 1, value)
+
+		template <typename T>
+		inline Record& operator<<(Record &r, const KeyValue<T> &kv)
+			// Text: " key=value"; structured: kept apart, and written after the message text
+		{
+			#ifdef MICRO_LOG_STRUCTURED
+			if(r.text) {
+				// Formatted after the text; if the text fills the record, its end is set aside meanwhile
+				const size_t room = sizeof(r.kv) - r.kvLen;
+				char saved[MICRO_LOG_KV_SIZE];
+				size_t nSaved = 0;
+				if(r.Room() < room) {
+					nSaved = room - r.Room() < r.len - r.text ? room - r.Room() : r.len - r.text;
+					r.len -= nSaved;
+					std::memcpy(saved, r.data + r.len, nSaved);
+				}
+				const size_t start = r.len;
+				r.Append(kv.key, kv.keyLen);
+				Structured::Value(r, kv.value);
+				const size_t n = r.len - start;
+				if(n < room && r.Room() > 0) {             // otherwise dropped, maybe truncated
+					std::memcpy(r.kv + r.kvLen, r.data + start, n);
+					r.kvLen += n;
+				}
+				std::memcpy(r.data + start, saved, nSaved);
+				r.len = start + nSaved;
+				return r;
+			}
+			#endif
+			#ifdef MICRO_LOG_BINARY
+			if(r.binary)
+				return r << kv.key << kv.value;
+			#endif
+			r.Append(kv.key, kv.keyLen);
+			return r << kv.value;
+		}
+
+		struct Sampler
+			/// State of a uLOG_EVERY_N, uLOG_FIRST_N or uLOG_RATE call site: a static of the call
+			/// site, zero at start and updated with relaxed atomics, checked after the level check
+			/// and before the message is formatted. Each policy returns 0 to skip the message,
+			/// otherwise 1 + the number of messages skipped since the previous one, reported at the
+			/// start of the message by Note.
+		{
+			struct Site {
+				std::atomic<unsigned long long> count;     // calls (EveryN, FirstN), skipped (Rate)
+				std::atomic<long long>          due;       // Rate: time of the next token (ns), 0 at start
+			};
+
+			struct Note {
+				unsigned long long pass;
+				explicit Note(unsigned long long _pass) : pass(_pass) {}
+			};
+
+			static unsigned long long EveryN(Site &s, unsigned long long n)
+				// The 1st, n+1th, 2n+1th ... calls
+			{
+				const unsigned long long i = s.count.fetch_add(1, std::memory_order_relaxed);
+				if(n <= 1)
+					return 1;
+				return i % n ? 0 : i ? n : 1;
+			}
+
+			static unsigned long long FirstN(Site &s, unsigned long long n)
+				// The first n calls; then a load only
+			{
+				if(s.count.load(std::memory_order_relaxed) >= n)
+					return 0;
+				return s.count.fetch_add(1, std::memory_order_relaxed) < n ? 1 : 0;
+			}
+
+			static unsigned long long Rate(Site &s, double perSecond)
+				// Token bucket of perSecond tokens (at least 1), refilled at perSecond tokens per second,
+				// as a generic cell rate algorithm: a single timestamp, updated with a compare and swap
+			{
+				if(!(perSecond > 0))
+					return 0;
+				const long long interval = perSecond < 1e9 ? (long long)(1e9 / perSecond) : 1;
+				const long long burst = perSecond > 1 ? (long long)((perSecond - 1) * double(interval)) : 0;
+				const long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				                          std::chrono::steady_clock::now().time_since_epoch()).count();
+
+				long long due = s.due.load(std::memory_order_relaxed);
+				do {
+					if(due != 0 && now < due - burst) {
+						s.count.fetch_add(1, std::memory_order_relaxed);
+						return 0;
+					}
+				} while(!s.due.compare_exchange_weak(due, (due > now ? due : now) + interval, std::memory_order_relaxed));
+
+				return s.count.exchange(0, std::memory_order_relaxed) + 1;
+			}
+		};
+
+		inline Record& operator<<(Record &r, const Sampler::Note &note) {
+			if(note.pass > 1) {
+				#ifdef MICRO_LOG_STRUCTURED
+				if(r.text)
+					return r << uLOG_KV("suppressed", note.pass - 1);
+				#endif
+				r << '(' << (note.pass - 1) << " suppressed) ";
+			}
+			return r;
+		}
+
+		inline Record& BeginLog(std::ostream &target, int level, const char *file, const char *fileName,
+		                        const char *func, const char *funcSig, const char *line)
+			// Start a new message, with the fields selected at run time in LogFields
+		{
+			Record &r = BeginRecord(target, level);
+			#ifdef MICRO_LOG_RELOAD
+			const unsigned fields = Reload::Fields();
 			#else
-				return "?";
+			const unsigned fields = LogFields::Mask();
+			#endif
+
+			#ifdef MICRO_LOG_SINKS       // kept to format the message for the other sinks
+			r.toTarget = level >= minLogLevel;
+			r.fields = fields;
+			r.time = Timestamp::Now();
+			r.file = file; r.fileName = fileName; r.func = func; r.funcSig = funcSig; r.line = line;
+			AppendFields(r, fields, r.time, file, fileName, func, funcSig, line);
+			r.body = r.len;
+			#else
+			#ifdef MICRO_LOG_RECORDER
+			r.toTarget = level >= minLogLevel;
 			#endif
+			const long long now = (fields & (MICRO_LOG_FIELD_TIME | MICRO_LOG_FIELD_DATE)) ? Timestamp::Now() : 0;
+			AppendFields(r, fields, now, file, fileName, func, funcSig, line);
+			#endif
+			return r;
 		}
 
+		#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+		inline Record& LocalLevel(Record &r, int localMinLevel) {
+			// uLOG_(): a local minimum level overrides uLog::minLogLevel for microLog_ofs
+			if(localMinLevel != nolog)
+				r.toTarget = true;
+			return r;
+		}
+		#endif
 
-		#define uLOGS_(logstream, level, localMinLevel)                               \
-			if(uLog::CheckLogLevel(level, localMinLevel) && uLog::CheckAvailableSpace())    \
-				MICRO_LOG_LOCK;                                                       \
-				logstream                                                             \
-					<< (uLog::LogFields::time?uLog::LogTime():"")                     \
-					<< (uLog::LogFields::date?uLog::LogDate():"")                     \
-					<< (uLog::LogFields::llevel?uLog::logLevelTags[level]:"")         \
-					<< (uLog::LogFields::llevel?uLog::separator:"")                   \
-					<< (uLog::LogFields::exec?MICRO_LOG_EXECUTABLE_NAME:"")           \
-					<< (uLog::LogFields::exec?uLog::separator:"")                     \
-					<< (uLog::LogFields::pid?uLog::GetPID():"")                       \
-					<< (uLog::LogFields::pid?uLog::separator:"")                      \
-					<< (uLog::LogFields::uid?uLog::GetUID():"")                       \
-					<< (uLog::LogFields::uid?uLog::separator:"")                      \
-					<< (uLog::LogFields::uname?uLog::GetUserName():"")                \
-					<< (uLog::LogFields::uname?uLog::separator:"")                    \
-					<< (uLog::LogFields::fileName?(strrchr(__FILE__, MICRO_LOG_DIR_SLASH) ? strrchr(__FILE__, MICRO_LOG_DIR_SLASH) + 1 : __FILE__):"")  \
-					<< (uLog::LogFields::fileName?uLog::separator:"")                 \
-					<< (uLog::LogFields::filePath?__FILE__:"")                        \
-					<< (uLog::LogFields::filePath?uLog::separator:"")                 \
-					<< (uLog::LogFields::funcName?__func__:"")                        \
-					<< (uLog::LogFields::funcName?uLog::separator:"")                 \
-					<< (uLog::LogFields::funcSig?__PRETTY_FUNCTION__:"")              \
-					<< (uLog::LogFields::funcSig?uLog::separator:"")                  \
-					<< (uLog::LogFields::line?std::to_string(__LINE__):"")            \
-					<< (uLog::LogFields::line?uLog::separator:"")                     \
-					<< ": "
+		template <unsigned fields>
+		inline Record& BeginLogC(std::ostream &target, int level, const char *site, size_t siteLen,
+		                         const char *func, size_t funcLen, const char *funcSig, size_t funcSigLen,
+		                         const char *tail, size_t tailLen)
+			// Start a new message, with the fields selected at compile time (MICRO_LOG_FIELDS).
+			// site: file name/path fields, plus line and ": " if there are no function fields;
+			// tail: the rest of the prefix after the function fields.
+		{
+			Record &r = BeginRecord(target, level);
+			#ifdef MICRO_LOG_RECORDER
+			r.toTarget = level >= minLogLevel;
+			#endif
+
+			if(fields & (MICRO_LOG_FIELD_TIME | MICRO_LOG_FIELD_DATE)) {
+				const long long now = Timestamp::Now();
+				if(fields & MICRO_LOG_FIELD_TIME)
+					r.len += Timestamp::FormatElapsed(r.data + r.len, now);
+				if(fields & MICRO_LOG_FIELD_DATE)
+					r.len += Timestamp::FormatDate(r.data + r.len, now);
+			}
+			if(fields & MICRO_LOG_FIELD_LEVEL) {
+				r.Append(logLevelTags[level], sizeof(logLevelTags[0]) - 1);
+				r.Append(MICRO_LOG_SEPARATOR, sizeof(MICRO_LOG_SEPARATOR) - 1);
+			}
+			if(fields & MICRO_LOG_FIELD_EXEC)
+				r.Append(MICRO_LOG_EXECUTABLE_NAME MICRO_LOG_SEPARATOR, sizeof(MICRO_LOG_EXECUTABLE_NAME MICRO_LOG_SEPARATOR) - 1);
+			if(fields & (MICRO_LOG_FIELD_PID | MICRO_LOG_FIELD_UID | MICRO_LOG_FIELD_UNAME)) {
+				ProcessFields::Check();
+				if(fields & MICRO_LOG_FIELD_PID)
+					r.Append(ProcessFields::pid.text, ProcessFields::pid.len);
+				if(fields & MICRO_LOG_FIELD_UID)
+					r.Append(ProcessFields::uid.text, ProcessFields::uid.len);
+				if(fields & MICRO_LOG_FIELD_UNAME)
+					r.Append(ProcessFields::uname.text, ProcessFields::uname.len);
+			}
+			r.Append(site, siteLen);
+			if(fields & MICRO_LOG_FIELD_FUNC_NAME) {
+				r.Append(func, funcLen);
+				r.Append(MICRO_LOG_SEPARATOR, sizeof(MICRO_LOG_SEPARATOR) - 1);
+			}
+			if(fields & MICRO_LOG_FIELD_FUNC_SIG) {
+				r.Append(funcSig, funcSigLen);
+				r.Append(MICRO_LOG_SEPARATOR, sizeof(MICRO_LOG_SEPARATOR) - 1);
+			}
+			r.Append(tail, tailLen);
+			return r;
+		}
+
+
+		#ifdef MICRO_LOG_BINARY
+
+		struct Binary
+			/// Binary mode: each call site is described once in the log by a site record, then
+			/// its messages only store the site id, the time and the raw arguments; the text is
+			/// produced offline by microLog_decode.
+		{
+			struct Site {
+				const char *file, *fileName, *func, *funcSig, *line;
+				unsigned    lineNum, id;
+				const Site *next;
+				mutable std::atomic<bool> recorded;     // site record in the log (not dropped)
+
+				Site(const char *_file, size_t nameOffset, unsigned _lineNum, const char *_line,
+				     const char *_func, const char *_funcSig)
+					: file(_file), fileName(_file + nameOffset), func(_func), funcSig(_funcSig), line(_line),
+					  lineNum(_lineNum), id(nSites.fetch_add(1, std::memory_order_relaxed) + 1), next(nullptr),
+					  recorded(false)
+				{
+					Register(this);
+				}
+			};
+
+			static std::atomic<const Site*> sites;      // registered call sites, the last first
+			static std::atomic<unsigned>    nSites;
+
+			static void Register(Site *site)
+				// Called once per call site, the first time it logs
+			{
+				site->next = sites.load(std::memory_order_relaxed);
+				while(!sites.compare_exchange_weak(site->next, site, std::memory_order_release, std::memory_order_relaxed)) {}
+				WriteSite(*site);
+			}
+
+			static size_t SiteRecord(char *rec, const Site &site)
+				// rec must hold maxLogSize bytes; returns the record length
+			{
+				const size_t maxString = (maxLogSize - BinaryLog::recordHead - 8) / 3 - 2;
+				char *p = BinaryLog::Put(rec + BinaryLog::recordHead, (unsigned)site.id);
+				p = BinaryLog::Put(p, (unsigned)site.lineNum);
+				p = BinaryLog::PutString(p, site.file, maxString);
+				p = BinaryLog::PutString(p, site.func, maxString);
+				p = BinaryLog::PutString(p, site.funcSig, maxString);
+				rec[0] = BinaryLog::site;
+				BinaryLog::SetLength(rec, size_t(p - rec));
+				return size_t(p - rec);
+			}
+
+			static size_t HeaderRecord(char *rec)
+				// rec must hold maxLogSize bytes; returns the record length
+			{
+				ProcessFields::Check();
+				char *p = rec + BinaryLog::recordHead;
+				std::memcpy(p, BinaryLog::Magic(), 4);
+				p = BinaryLog::Put(p + 4, BinaryLog::version);
+				p = BinaryLog::Put(p, BinaryLog::byteOrder);
+				p = BinaryLog::Put(p, Timestamp::Origin().wallNs);
+				p = BinaryLog::PutString(p, separator, 16);
+				const ProcessFields::Field *fields[] = { &ProcessFields::exec, &ProcessFields::pid, &ProcessFields::uid, &ProcessFields::uname };
+				for(const ProcessFields::Field *f : fields) {
+					p = BinaryLog::Put(p, (unsigned short)f->len);
+					std::memcpy(p, f->text, f->len);
+					p += f->len;
+				}
+				rec[0] = BinaryLog::header;
+				BinaryLog::SetLength(rec, size_t(p - rec));
+				return size_t(p - rec);
+			}
+
+			static void WriteSite(const Site &site)
+			{
+				if(!microLog_ofs.is_open())     // written by uLOG_START
+					return;
+				char rec[maxLogSize];
+				site.recorded.store(WriteMessage(&microLog_ofs, nolog, rec, SiteRecord(rec, site), false),
+				                    std::memory_order_relaxed);
+			}
+
+			static void Start()
+				// Called by uLOG_START: header, and the sites already registered
+			{
+				char rec[maxLogSize];
+				WriteMessage(&microLog_ofs, nolog, rec, HeaderRecord(rec), false);     // records, not messages: not in the statistics
+
+				for(const Site *site = sites.load(std::memory_order_acquire); site; site = site->next)
+					WriteSite(*site);
+			}
+
+			static void Restart(std::ostream &os)
+				// Header and sites at the beginning of a new file (the caller is the only writer)
+			{
+				char rec[maxLogSize];
+				os.write(rec, std::streamsize(HeaderRecord(rec)));
+				for(const Site *site = sites.load(std::memory_order_acquire); site; site = site->next) {
+					os.write(rec, std::streamsize(SiteRecord(rec, *site)));
+					site->recorded.store(true, std::memory_order_relaxed);
+				}
+			}
+
+			static Record& BeginLog(std::ostream &target, int level, const Site &site)
+				// Start a new message: fixed size header, then the raw arguments
+			{
+				if(&target != &microLog_ofs)        // text to the other streams
+					return uLog::BeginLog(target, level, site.file, site.fileName, site.func, site.funcSig, site.line);
+
+				if(!site.recorded.load(std::memory_order_relaxed))     // dropped (no space, segment not mapped)
+					WriteSite(site);
+				Record &r = BeginRecord(target, level);
+				#if defined(MICRO_LOG_FIELDS)
+					const unsigned short fields = MICRO_LOG_FIELDS;
+				#elif defined(MICRO_LOG_RELOAD)
+					const unsigned short fields = (unsigned short)Reload::Fields();
+				#else
+					const unsigned short fields = (unsigned short)LogFields::Mask();
+				#endif
+				char *p = r.data;
+				*p++ = BinaryLog::message;
+				p += 2;                              // length, set by Commit
+				p = BinaryLog::Put(p, (unsigned)site.id);
+				p = BinaryLog::Put(p, (unsigned char)level);
+				p = BinaryLog::Put(p, (unsigned char)Timestamp::Precision());
+				p = BinaryLog::Put(p, fields);
+				p = BinaryLog::Put(p, (long long)Timestamp::Now());
+				r.len = size_t(p - r.data);
+				r.binary = true;
+				return r;
+			}
+		};
+
+		#endif // MICRO_LOG_BINARY
+
+
+		#ifdef MICRO_LOG_ROTATION
+
+		inline void Rotation::Rotate()
+			// Switch to the next file; the caller is the only writer of microLog_ofs
+		{
+			std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+			if(!lock.owns_lock() || !nextReady) {      // never wait: retry with the next message
+				nDeferred.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			const std::string rotated = RotatedName();
+			microLog_ofs.flush();
+			if(std::rename(logFilename.c_str(), rotated.c_str()) != 0)
+				return;
+			if(std::rename(NextName().c_str(), logFilename.c_str()) != 0) {
+				std::rename(rotated.c_str(), logFilename.c_str());
+				return;
+			}
+
+			microLog_ofs.swap(next);
+			#ifdef MICRO_LOG_GROUP_COMMIT
+			if(GroupCommit::fd >= 0 && nextFd >= 0)
+				dup2(nextFd, GroupCommit::fd);           // atomic: no write is lost
+			#endif
+			nextReady = false;
+
+			bytes = 0;
+			if(interval > 0)
+				deadline = Timestamp::Now() + interval * 1000000000LL;
+			nRotations.fetch_add(1, std::memory_order_relaxed);
+
+			#ifdef MICRO_LOG_BINARY
+			Binary::Restart(microLog_ofs);
+			microLog_ofs.flush();                        // before any group commit write
+			#endif
+
+			cond.notify_one();
+		}
+
+		#endif // MICRO_LOG_ROTATION
+
+		// Call site constants, resolved at compile time
+
+		#define uLOG_STR_(x)  #x
+		#define uLOG_STR(x)   uLOG_STR_(x)
+
+		#define uLOG_LITERAL(offset, s)  (s) + (offset), sizeof(s) - 1 - (offset)
+
+		#define uLOG_BASENAME_OFFSET  std::integral_constant<size_t, uLog::BaseNameOffset(__FILE__)>::value
+
+		#if defined(MICRO_LOG_BINARY)
+
+			// Call site descriptor, registered the first time the call site logs
+			#define uLOG_BINARY_SITE                                                                       \
+				[](const char *func, const char *funcSig) -> const uLog::Binary::Site& {                   \
+					static const uLog::Binary::Site site(__FILE__, uLOG_BASENAME_OFFSET, __LINE__,         \
+					                                     uLOG_STR(__LINE__), func, funcSig);               \
+					return site;                                                                           \
+				}(__func__, __PRETTY_FUNCTION__)
+
+			#define uLOG_BEGIN(logstream, level)  \
+				uLog::Binary::BeginLog(logstream, level, uLOG_BINARY_SITE)
+
+		#elif defined(MICRO_LOG_FIELDS) && !defined(MICRO_LOG_SINKS) && !defined(MICRO_LOG_STRUCTURED)     // sinks, structured: fields selected at run time
+
+			// Static part of the message prefix, folded in as few string literals as possible.
+			// Note: the file name is a suffix of the file path, so "path SEP path SEP" + offset
+			//       is "name SEP path SEP".
+
+			#if((MICRO_LOG_FIELDS) & MICRO_LOG_FIELD_LINE)
+				#define uLOG_SITE_TAIL  uLOG_STR(__LINE__) MICRO_LOG_SEPARATOR ": "
+			#else
+				#define uLOG_SITE_TAIL  ": "
+			#endif
+
+			#if((MICRO_LOG_FIELDS) & MICRO_LOG_FIELD_FILE_NAME) && ((MICRO_LOG_FIELDS) & MICRO_LOG_FIELD_FILE_PATH)
+				#define uLOG_SITE_FILE    __FILE__ MICRO_LOG_SEPARATOR __FILE__ MICRO_LOG_SEPARATOR
+				#define uLOG_SITE_OFFSET  uLOG_BASENAME_OFFSET
+			#elif((MICRO_LOG_FIELDS) & MICRO_LOG_FIELD_FILE_NAME)
+				#define uLOG_SITE_FILE    __FILE__ MICRO_LOG_SEPARATOR
+				#define uLOG_SITE_OFFSET  uLOG_BASENAME_OFFSET
+			#elif((MICRO_LOG_FIELDS) & MICRO_LOG_FIELD_FILE_PATH)
+				#define uLOG_SITE_FILE    __FILE__ MICRO_LOG_SEPARATOR
+				#define uLOG_SITE_OFFSET  0
+			#else
+				#define uLOG_SITE_FILE    ""
+				#define uLOG_SITE_OFFSET  0
+			#endif
+
+			#if((MICRO_LOG_FIELDS) & (MICRO_LOG_FIELD_FUNC_NAME | MICRO_LOG_FIELD_FUNC_SIG))
+				#define uLOG_SITE                                                                          \
+					uLOG_LITERAL(uLOG_SITE_OFFSET, uLOG_SITE_FILE),                                        \
+					__func__, sizeof(__func__) - 1, __PRETTY_FUNCTION__, sizeof(__PRETTY_FUNCTION__) - 1,  \
+					uLOG_LITERAL(0, uLOG_SITE_TAIL)
+			#else
+				#define uLOG_SITE                                                                          \
+					uLOG_LITERAL(uLOG_SITE_OFFSET, uLOG_SITE_FILE uLOG_SITE_TAIL),                         \
+					nullptr, 0, nullptr, 0, "", 0
+			#endif
+
+			#define uLOG_BEGIN(logstream, level)  \
+				uLog::BeginLogC<(MICRO_LOG_FIELDS)>(logstream, level, uLOG_SITE)
+
+		#else  // MICRO_LOG_FIELDS
+
+			#define uLOG_BEGIN(logstream, level)  \
+				uLog::BeginLog(logstream, level, __FILE__, __FILE__ + uLOG_BASENAME_OFFSET, __func__, __PRETTY_FUNCTION__, uLOG_STR(__LINE__))
+
+		#endif // MICRO_LOG_BINARY, MICRO_LOG_FIELDS
+
+
+		#define uLOG_ENABLED(level, localMinLevel)                                    \
+			(uLOG_UNLIKELY(uLog::LevelEnabled(level, localMinLevel)) && uLog::CheckLogLevel(level, localMinLevel))
+
+		#ifdef MICRO_LOG_COALESCE
+			#define uLOG_BEGIN_SITE(logstream, level)                                 \
+				uLog::Coalescer::At(uLOG_BEGIN(logstream, level), __FILE__, __LINE__)
+		#else
+			#define uLOG_BEGIN_SITE(logstream, level)  uLOG_BEGIN(logstream, level)
+		#endif
+
+		#if defined(MICRO_LOG_SINKS) || defined(MICRO_LOG_RECORDER)
+			#define uLOG_BEGIN_LOCAL(logstream, level, localMinLevel)                 \
+				uLog::LocalLevel(uLOG_BEGIN_SITE(logstream, level), localMinLevel)
+		#else
+			#define uLOG_BEGIN_LOCAL(logstream, level, localMinLevel)                 \
+				uLOG_BEGIN_SITE(logstream, level)
+		#endif
+
+		#ifdef MICRO_LOG_LEVELS
+			// The call site's rule, as a local level (module: a string literal, or nullptr)
+			#define uLOG_SITE_LEVEL(module, localMinLevel)                            \
+				uLog::Levels::Threshold([]() -> uLog::Levels::Site& {                 \
+					static uLog::Levels::Site site(module, __FILE__);                 \
+					return site;                                                      \
+				}(), localMinLevel, __func__, __PRETTY_FUNCTION__)
+
+			#define uLOGSM_(logstream, module, level, localMinLevel)                  \
+				if(uLOG_LIKELY(!uLog::Levels::Possible(level, localMinLevel))) {}     \
+				else switch(int uLOG_local = uLOG_SITE_LEVEL(module, localMinLevel))  \
+				default:                                                              \
+					if(uLOG_ENABLED(level, uLOG_local))                               \
+						uLOG_BEGIN_LOCAL(logstream, level, uLOG_local)
+
+			#define uLOGS_(logstream, level, localMinLevel)  uLOGSM_(logstream, nullptr, level, localMinLevel)
+		#else
+			#define uLOGSM_(logstream, module, level, localMinLevel)  uLOGS_(logstream, level, localMinLevel)
+
+			#define uLOGS_(logstream, level, localMinLevel)                           \
+				if(uLOG_ENABLED(level, localMinLevel))                                \
+					uLOG_BEGIN_LOCAL(logstream, level, localMinLevel)
+		#endif
 
 		#define uLOGS(logstream, level)  uLOGS_(logstream, level, nolog)
 
+		#define uLOGM(module, level)  uLOGSM_(uLog::microLog_ofs, module, level, nolog)
+
 		#define uLOG_(level, localMinLevel)  uLOGS_(uLog::microLog_ofs, level, localMinLevel)
 
 		#define uLOG(level)  uLOGS_(uLog::microLog_ofs, level, nolog)
 
-		#define uLOGF(logfname, level, minLogLev, logMsg) {                                 \
-			if(level >= minLogLev && uLog::CheckAvailableSpace(logfname)) {                 \
-				MICRO_LOG_LOCK;                                                             \
-				std::ofstream ofs(logfname, std::fstream::app);                             \
-				ofs << uLog::LogDate()                                                      \
-					<< uLog::logLevelTags[level] << uLog::separator                         \
-					<< logMsg << std::endl;                                                 \
-				MICRO_LOG_UNLOCK;                                                           \
-			}                                                                               \
-		}
+		// uLOGFMT(level, format, args...): a whole message (no uLOGE), see Format
+		#define uLOG_FORMAT_STRING(format, ...)  format
+
+		#define uLOG_FORMAT(...)                                                      \
+			uLog::Format::Make<uLog::Format::Count(uLOG_FORMAT_STRING(__VA_ARGS__, 0)),  \
+			                   uLog::Format::Kinds(uLOG_FORMAT_STRING(__VA_ARGS__, 0))>(__VA_ARGS__)
+
+		#define uLOGFMT_(level, localMinLevel, ...)                                   \
+			uLOGS_(uLog::microLog_ofs, level, localMinLevel) << uLOG_FORMAT(__VA_ARGS__) << uLog::endm
+
+		#define uLOGFMT(level, ...)  uLOGFMT_(level, nolog, __VA_ARGS__)
+
+		// uLOG_EVERY_N(level, n), uLOG_FIRST_N(level, n), uLOG_RATE(level, perSecond): as uLOG,
+		// for a part of the calls passing the level check (see Sampler)
+		#ifdef MICRO_LOG_LEVELS
+			#define uLOG_SAMPLE_POSSIBLE(level)  uLog::Levels::Possible(level, nolog)
+		#else
+			#define uLOG_SAMPLE_POSSIBLE(level)  uLog::LevelEnabled(level)
+		#endif
+
+		#define uLOG_SAMPLED(level, policy, arg)                                      \
+			if(uLOG_LIKELY(!uLOG_SAMPLE_POSSIBLE(level))) {}                          \
+			else switch(unsigned long long uLOG_pass = uLog::Sampler::policy(         \
+				[]() -> uLog::Sampler::Site& {                                        \
+					static uLog::Sampler::Site site;                                  \
+					return site;                                                      \
+				}(), arg))                                                            \
+			default:                                                                  \
+				if(uLOG_pass == 0) {}                                                 \
+				else uLOG(level) << uLog::Sampler::Note(uLOG_pass)
+
+		#define uLOG_EVERY_N(level, n)       uLOG_SAMPLED(level, EveryN, n)
+		#define uLOG_FIRST_N(level, n)       uLOG_SAMPLED(level, FirstN, n)
+		#define uLOG_RATE(level, perSecond)  uLOG_SAMPLED(level, Rate, perSecond)
+
+		#ifdef MICRO_LOG_BINARY       // uLOGF to the binary log file: a text record
+			#define uLOGF_BINARY(logfname, level, minLogLev, logMsg)                           \
+				if(level >= minLogLev && uLog::microLog_ofs.is_open() && uLog::logFilename == logfname) { \
+					uLog::BeginRecord(uLog::microLog_ofs, level) << uLog::LogDate()             \
+						<< uLog::logLevelTags[level] << uLog::separator                         \
+						<< logMsg << uLog::endm;                                                \
+				}                                                                               \
+				else
+		#else
+			#define uLOGF_BINARY(logfname, level, minLogLev, logMsg)
+		#endif
+
+		#ifndef WIN32
+			// logMsg: the message, without uLOGE; the file stays open in FileCache
+			#define uLOGF(logfname, level, minLogLev, logMsg) {                             \
+				uLOGF_BINARY(logfname, level, minLogLev, logMsg)                            \
+				if(level >= minLogLev)                                                      \
+					uLog::FileCache::Write(logfname, uLog::BeginFileRecord(level) << logMsg); \
+			}
+		#else
+			#define uLOGF(logfname, level, minLogLev, logMsg) {                             \
+				uLOGF_BINARY(logfname, level, minLogLev, logMsg)                            \
+				if(level >= minLogLev && uLog::CheckAvailableSpace(logfname)) {             \
+					MICRO_LOG_LOCK;                                                         \
+					std::ofstream ofs(logfname, std::fstream::app);                         \
+					ofs << uLog::LogDate()                                                  \
+						<< uLog::logLevelTags[level] << uLog::separator                     \
+						<< logMsg << std::endl;                                             \
+					MICRO_LOG_UNLOCK;                                                       \
+				}                                                                           \
+			}
+		#endif
 
+		#ifdef MICRO_LOG_STRUCTURED    // no column titles: the fields have their keys
 		#define uLOG_TITLES_S(logstream, level)                                       \
-			if(uLog::CheckLogLevel(level))                                            \
-				MICRO_LOG_LOCK;                                                       \
-				logstream                                                             \
+			if(0) uLog::BeginRecord(logstream, level)
+		#else
+		#define uLOG_TITLES_S(logstream, level)                                       \
+			if(uLOG_ENABLED(level, nolog))                                            \
+				uLog::BeginRecord(logstream, level)                                   \
 					<< uLog::bar << "\n"                                              \
 					<< (uLog::LogFields::time?"Time     ":"")                         \
-					<< (uLog::LogFields::date?"Date                 ":"")             \
+					<< (uLog::LogFields::date?uLog::Timestamp::DateTitle():"")        \
 					<< (uLog::LogFields::llevel?"Level   ":"")                        \
 					<< (uLog::LogFields::llevel?uLog::separator:"")                   \
 					<< (uLog::LogFields::exec?"Exec.  ":"")                           \
@@ -545,70 +6050,293 @@ namespace uLog {
 					<< (uLog::LogFields::line?"Line  ":"")                            \
 					<< (uLog::LogFields::llevel?uLog::separator:"")                   \
 					<< "Log"                                                          \
-					<< "\n" << uLog::bar << uLog::endm;                               \
-				MICRO_LOG_UNLOCK
+					<< "\n" << uLog::bar << uLog::endm
+		#endif
 
 		#define uLOG_TITLES(level)  uLOG_TITLES_S(uLog::microLog_ofs, level)
 
 
 		// uLOG log terminator
-		#define uLOGE uLog::endm; MICRO_LOG_UNLOCK
+		#define uLOGE uLog::endm
 
 		#define uLOGT(level) \
-			if(uLog::CheckLogLevel(level)) \
-				uLog::microLog_ofs
+			if(uLOG_ENABLED(level, nolog)) \
+				uLog::BeginLine(uLog::microLog_ofs, level)
 
 		#define uLOG_DATE \
 			if(std::time(&uLog::microLog_time)) \
-				uLog::microLog_ofs << "\nDate: " << std::ctime(&uLog::microLog_time)
+				uLog::EndLine(uLog::BeginLine(uLog::microLog_ofs, info) << "\nDate: " << std::ctime(&uLog::microLog_time))
 
 		#define uLOGD(level) \
-			if(std::time(&uLog::microLog_time), uLog::CheckLogLevel(level)) \
-				uLog::microLog_ofs << "\nDate: " << std::ctime(&uLog::microLog_time)
+			if(std::time(&uLog::microLog_time), uLOG_ENABLED(level, nolog)) \
+				uLog::BeginLine(uLog::microLog_ofs, level) << "\nDate: " << std::ctime(&uLog::microLog_time)
 
 		#define uLOGB(level) \
-			if(uLog::CheckLogLevel(level)) \
-				uLog::microLog_ofs << bar << uLog::endm
+			if(uLOG_ENABLED(level, nolog)) \
+				uLog::BeginLine(uLog::microLog_ofs, level) << uLog::bar << uLog::endm
 
 		#ifndef MICRO_LOG_DLL
 		inline void LogLevels() {
-			uLog::microLog_ofs << "Log levels: ";
+			Record &r = BeginLine(microLog_ofs, info);
+			r << "Log levels: ";
 			for(size_t i = 0; i < uLog::nLogLevels; ++i)
-				uLog::microLog_ofs << uLog::logLevelTags[i] << " ";
-			uLog::microLog_ofs << std::endl;
+				r << uLog::logLevelTags[i] << " ";
+			r << std::endl;
 		}
 
 		inline void MinLogLevel() {
-			uLog::microLog_ofs << "Minimum log level to be logged: " << uLog::logLevelTags[uLog::minLogLevel] << std::endl;
+			BeginLine(microLog_ofs, info) << "Minimum log level to be logged: " << uLog::logLevelTags[uLog::minLogLevel] << std::endl;
+		}
+
+		inline int Statistics::Histogram::Bucket(unsigned long long ns)
+		{
+			if(ns < 16)
+				return int(ns);
+			#if defined(__GNUC__)
+			const int e = 63 - __builtin_clzll(ns);
+			#else
+			int e = 4;
+			while(ns >> (e + 1)) ++e;
+			#endif
+			const int bucket = 16 + (e - 4) * 8 + int((ns >> (e - 3)) & 7);
+			return bucket < nBuckets ? bucket : nBuckets - 1;
+		}
+
+		inline unsigned long long Statistics::Histogram::Value(int bucket)
+		{
+			if(bucket < 16)
+				return (unsigned long long)bucket;
+			const int e = 4 + (bucket - 16) / 8;
+			return ((8ULL + (unsigned long long)((bucket - 16) % 8) + 1) << (e - 3)) - 1;
+		}
+
+		inline unsigned long long Statistics::Totals::Called() const {
+			unsigned long long n = 0;
+			for(int i = 0; i < nLogLevels; ++i) n += called[i];
+			return n;
+		}
+
+		inline unsigned long long Statistics::Totals::Emitted() const {
+			unsigned long long n = 0;
+			for(int i = 0; i < nLogLevels; ++i) n += emitted[i];
+			return n;
+		}
+
+		inline unsigned long long Statistics::Totals::Count(const unsigned long long *histogram) {
+			unsigned long long n = 0;
+			for(int i = 0; i < Histogram::nBuckets; ++i) n += histogram[i];
+			return n;
+		}
+
+		inline unsigned long long Statistics::Totals::Percentile(const unsigned long long *histogram, double p)
+			// Latency not exceeded by the fraction p of the messages (p = 1: max)
+		{
+			const unsigned long long n = Count(histogram);
+			if(n == 0)
+				return 0;
+			unsigned long long rank = (unsigned long long)(p * double(n) + 0.999999), seen = 0;
+			if(rank < 1) rank = 1;
+			for(int i = 0; i < Histogram::nBuckets; ++i)
+				if((seen += histogram[i]) >= rank)
+					return Histogram::Value(i);
+			return Histogram::Value(Histogram::nBuckets - 1);
+		}
+
+		inline Statistics::Counters& Statistics::Local()
+			// This thread's counters: reused from an ended thread, or added to all
+		{
+			struct Owner {
+				Counters *c;
+				Owner() : c(nullptr) {
+					for(Counters *p = all.load(std::memory_order_acquire); p && !c; p = p->next) {
+						bool free = false;
+						if(p->inUse.compare_exchange_strong(free, true))
+							c = p;
+					}
+					if(!c) {
+						c = new Counters();
+						c->inUse.store(true, std::memory_order_relaxed);
+						c->next = all.load(std::memory_order_relaxed);
+						while(!all.compare_exchange_weak(c->next, c, std::memory_order_release, std::memory_order_relaxed)) {}
+					}
+				}
+				~Owner() { c->inUse.store(false, std::memory_order_release); }   // the counts stay in the totals
+			};
+			static thread_local Owner owner;
+			return *owner.c;
+		}
+
+		inline void Statistics::Sum(Totals &t)
+		{
+			std::memset(&t, 0, sizeof(t));
+			for(Counters *c = all.load(std::memory_order_acquire); c; c = c->next) {
+				for(int i = 0; i < nLogLevels; ++i) {
+					t.called[i]  += c->called[i].load(std::memory_order_relaxed);
+					t.emitted[i] += c->emitted[i].load(std::memory_order_relaxed);
+				}
+				t.dropped += c->dropped.load(std::memory_order_relaxed);
+				t.bytes   += c->bytes.load(std::memory_order_relaxed);
+				for(int i = 0; i < Histogram::nBuckets; ++i) {
+					t.format[i] += c->format.count[i].load(std::memory_order_relaxed);
+					t.write[i]  += c->write.count[i].load(std::memory_order_relaxed);
+				}
+			}
 		}
 
 		inline void Statistics::Update(int level) {
-			++nLogs;
-			if(level > highestLevel) highestLevel = level;
-			switch (level) {
-			case nolog:    ++nNoLogs;       break;
-			case verbose:  ++nVerboseLogs;  break;
-			case detail:   ++nDetailLogs;   break;
-			case info:     ++nInfoLogs;     break;
-			case warning:  ++nWarningLogs;  break;
-			case error:    ++nErrorLogs;    break;
-			case critical: ++nCriticalLogs; break;
-			case fatal:    ++nFatalLogs;    break;
+			if(unsigned(level) < unsigned(nLogLevels))
+				Counters::Add(Local().called[level]);
+		}
+
+		inline void Statistics::Emitted(int level, size_t bytes) {
+			Counters &c = Local();
+			if(unsigned(level) < unsigned(nLogLevels))
+				Counters::Add(c.emitted[level]);
+			Counters::Add(c.bytes, bytes);
+		}
+
+		inline void Statistics::Dropped() {
+			Counters::Add(Local().dropped);
+		}
+
+		inline void Statistics::Latency(long long formatNs, long long writeNs) {
+			Counters &c = Local();
+			Counters::Add(c.format.count[Histogram::Bucket(formatNs > 0 ? (unsigned long long)formatNs : 0)]);
+			Counters::Add(c.write.count[Histogram::Bucket(writeNs > 0 ? (unsigned long long)writeNs : 0)]);
+		}
+
+		inline long long Statistics::Clock() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			           std::chrono::steady_clock::now().time_since_epoch()).count() | 1;     // never 0
+		}
+
+		inline bool Statistics::Export(const std::string &name)
+			// Write a Snapshot of the totals to the shared memory object name (by default
+			// "/microLog.<pid>"), created at the first call and removed at exit; then
+			// Statistics::Log() updates it too
+		{
+			#ifdef _POSIX_VERSION
+			if(!snapshot) {
+				snapshotName = name.empty() ? "/microLog." + std::to_string(getpid()) : name;
+				const int fd = shm_open(snapshotName.c_str(), O_CREAT | O_RDWR, 0644);
+				if(fd < 0)
+					return false;
+				void *p = MAP_FAILED;
+				if(ftruncate(fd, off_t(sizeof(Snapshot))) == 0)
+					p = mmap(nullptr, sizeof(Snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				close(fd);
+				if(p == MAP_FAILED) {
+					shm_unlink(snapshotName.c_str());
+					return false;
+				}
+				snapshot = static_cast<Snapshot*>(p);
+				std::memcpy(snapshot->magic, "uLOGstat", sizeof(snapshot->magic));
+				snapshot->version = 1;
+				snapshot->pid = getpid();
+				static bool atExitSet = false;
+				if(!atExitSet) {
+					std::atexit([]() { shm_unlink(snapshotName.c_str()); });
+					atExitSet = true;
+				}
 			}
+
+			static Totals t;          // large: not on the stack
+			MICRO_LOG_LOCK;
+			Sum(t);
+			const long long now = Timestamp::Now(), elapsed = Timestamp::Elapsed(now);
+			const unsigned seq = snapshot->seq.load(std::memory_order_relaxed);
+			snapshot->seq.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			snapshot->time = now;
+			snapshot->bytesPerSecond = elapsed > 0 ? double(t.bytes) * 1e9 / double(elapsed) : 0;
+			const double ps[4] = { 0.5, 0.99, 0.999, 1 };
+			for(int i = 0; i < 4; ++i) {
+				snapshot->formatNs[i] = Totals::Percentile(t.format, ps[i]);
+				snapshot->writeNs[i] = Totals::Percentile(t.write, ps[i]);
+			}
+			snapshot->totals = t;
+			snapshot->seq.store(seq + 2, std::memory_order_release);
+			MICRO_LOG_UNLOCK;
+			return true;
+			#else
+			return false;
+			#endif
 		}
 
 		inline void Statistics::Log() {
-			microLog_ofs << "Log statistics:"
-				<< "\n\tNumber of logs: " << nLogs
-				<< "\n\tNumber of 'fatal' logs:    " << nFatalLogs
-				<< "\n\tNumber of 'critical' logs: " << nCriticalLogs
-				<< "\n\tNumber of 'error' logs:    " << nErrorLogs
-				<< "\n\tNumber of 'warning' logs:  " << nWarningLogs
-				<< "\n\tNumber of 'info' logs:     " << nInfoLogs
-				<< "\n\tNumber of 'detail' logs:   " << nDetailLogs
-				<< "\n\tNumber of 'verbose' logs:  " << nVerboseLogs
-				<< "\n\tNumber of 'null' logs:     " << nNoLogs << std::endl;
-			microLog_ofs << "Highest log level: " << highestLevel << std::endl;
+			static Totals t;
+			MICRO_LOG_LOCK;
+			Sum(t);
+			MICRO_LOG_UNLOCK;
+			int highestLevel = 0;
+			for(int i = 0; i < nLogLevels; ++i)
+				if(t.called[i]) highestLevel = i;
+			const long long elapsed = Timestamp::Elapsed(Timestamp::Now());
+
+			BeginLine(microLog_ofs, info) << "Log statistics:"
+				<< "\n\tNumber of logs: " << t.Called()
+				<< "\n\tNumber of 'fatal' logs:    " << t.called[fatal]
+				<< "\n\tNumber of 'critical' logs: " << t.called[critical]
+				<< "\n\tNumber of 'error' logs:    " << t.called[error]
+				<< "\n\tNumber of 'warning' logs:  " << t.called[warning]
+				<< "\n\tNumber of 'info' logs:     " << t.called[info]
+				<< "\n\tNumber of 'detail' logs:   " << t.called[detail]
+				<< "\n\tNumber of 'verbose' logs:  " << t.called[verbose]
+				<< "\n\tNumber of 'null' logs:     " << t.called[nolog] << std::endl;
+			BeginLine(microLog_ofs, info) << "Highest log level: " << highestLevel << std::endl;
+			BeginLine(microLog_ofs, info) << "Written messages: " << t.Emitted()
+				<< "\n\tDropped messages: " << t.dropped
+				<< "\n\tBytes:            " << t.bytes
+				<< "\n\tBytes/s:          " << (elapsed > 0 ? (unsigned long long)(double(t.bytes) * 1e9 / double(elapsed)) : 0ULL) << std::endl;
+			if(Totals::Count(t.format) > 0)
+				BeginLine(microLog_ofs, info) << "Latency (ns), p50 / p99 / p99.9 / max:"
+					<< "\n\tFormat:           " << Totals::Percentile(t.format, 0.5) << " / " << Totals::Percentile(t.format, 0.99)
+					<< " / " << Totals::Percentile(t.format, 0.999) << " / " << Totals::Percentile(t.format, 1)
+					<< "\n\tWrite:            " << Totals::Percentile(t.write, 0.5) << " / " << Totals::Percentile(t.write, 0.99)
+					<< " / " << Totals::Percentile(t.write, 0.999) << " / " << Totals::Percentile(t.write, 1) << std::endl;
+			if(snapshot)
+				Export(snapshotName);
+			#ifdef MICRO_LOG_ASYNC
+			BeginLine(microLog_ofs, info) << "Asynchronous mode:"
+				<< "\n\tQueued messages:  " << Async::nQueued.load()
+				<< "\n\tDropped messages: " << Async::nDropped.load()
+				<< "\n\tBlocked pushes:   " << Async::nBlocked.load()
+				<< "\n\tWritten batches:  " << Async::nBatches.load() << std::endl;
+			#endif
+			BeginLine(microLog_ofs, info) << "Flushes: " << FlushPolicy::nFlushes
+				<< "\n\tBy level:         " << FlushPolicy::nLevelFlushes
+				<< "\n\tBy size:          " << FlushPolicy::nSizeFlushes
+				<< "\n\tBy time:          " << FlushPolicy::nTimeFlushes
+				<< "\n\tAt exit/fatal:    " << FlushPolicy::nExitFlushes << std::endl;
+			#ifdef MICRO_LOG_CLIENT
+			BeginLine(microLog_ofs, info) << "Log server:"
+				<< "\n\tAttached:         " << (Client::ring.load() ? "yes" : "no")
+				<< "\n\tQueued messages:  " << Client::nQueued.load()
+				<< "\n\tBlocked messages: " << Client::nBlocked.load()
+				<< "\n\tWakeups:          " << Client::nWakeups.load() << std::endl;
+			#endif
+			#ifdef MICRO_LOG_TIERING
+			BeginLine(microLog_ofs, info) << "Tiering:"
+				<< "\n\tDrained bytes:    " << Tiering::nBytes.load()
+				<< "\n\tDrains:           " << Tiering::nDrains.load()
+				<< "\n\tFreed bytes:      " << Tiering::nFreed.load()
+				<< "\n\tErrors:           " << Tiering::nErrors.load() << std::endl;
+			#endif
+			#ifdef MICRO_LOG_ROTATION
+			BeginLine(microLog_ofs, info) << "Rotation:"
+				<< "\n\tRotated files:    " << Rotation::nRotations.load()
+				<< "\n\tDeferred:         " << Rotation::nDeferred.load() << std::endl;
+			#endif
+			#ifdef MICRO_LOG_MMAP
+			BeginLine(microLog_ofs, info) << "Memory mapped file:"
+				<< "\n\tMapped segments:  " << MappedFile::nSegments.load()
+				<< "\n\tMapping failures: " << MappedFile::nFailures.load() << std::endl;
+			#endif
+			#ifdef MICRO_LOG_GROUP_COMMIT
+			BeginLine(microLog_ofs, info) << "Group commit:"
+				<< "\n\tWritten messages: " << GroupCommit::nRecords.load()
+				<< "\n\tWritten groups:   " << GroupCommit::nGroups.load() << std::endl;
+			#endif
 		}
 
 		#endif // MICRO_LOG_DLL
@@ -663,8 +6391,6 @@ namespace uLog {
 				using namespace uLog;                          \
 				int uLog::minLogLevel = MICRO_LOG_MIN_LEVEL;   \
 				nullstream uLog::microLog_ofs;                 \
-				int Statistics::nLogs = 0, Statistics::nNoLogs = 0, Statistics::nVerboseLogs = 0, Statistics::nDetailLogs = 0, Statistics::nInfoLogs = 0, Statistics::nWarningLogs = 0, Statistics::nErrorLogs = 0, Statistics::nCriticalLogs = 0, Statistics::nFatalLogs = 0; \
-				int Statistics::highestLevel = 0;              \
 				bool LogFields::time = false, LogFields::date = true, LogFields::llevel = true, LogFields::exec = false, \
 					 LogFields::uid = false, LogFields::uname = false, LogFields::pid = false, \
 					 LogFields::fileName = false, LogFields::filePath = false, LogFields::funcName = false, LogFields::funcSig = false, \
@@ -691,6 +6417,13 @@ namespace uLog {
 
 		#define uLOG(level)                  if(0) microLog_ofs
 		#define uLOG_(level, localMinLevel)  if(0) microLog_ofs
+		#define uLOGM(module, level)         if(0) microLog_ofs
+		#define uLOGFMT(level, ...)          if(0) microLog_ofs
+		#define uLOGFMT_(level, localMinLevel, ...)  if(0) microLog_ofs
+		#define uLOG_EVERY_N(level, n)       if(0) microLog_ofs
+		#define uLOG_FIRST_N(level, n)       if(0) microLog_ofs
+		#define uLOG_RATE(level, perSecond)  if(0) microLog_ofs
+		#define uLOG_KV(name, value)         ""
 		#define uLOGF(logfname, level, minLogLev, logMsg)
 		#define uLOGE                        ""
 		#define uLOG_DATE                    if(0) microLog_ofs
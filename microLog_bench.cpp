@@ -0,0 +1,336 @@
+/// microLog_bench.cpp
+
+// Benchmark of the logger, built with the same options as microLog_test (build it as Release).
+// For each destination directory, with one thread and with N threads, it measures the throughput
+// (messages/s) and the per-call latency (p50, p99, p99.9, max) of:
+//   fwrite      a raw fwrite of a message of the same length (fflush with FlushPolicy::Always()), as baseline;
+//   uLOG        with each LogFields preset: default, detailed, system, debug, verbose;
+//   uLOGFMT     the same message from a format string, default fields;
+//   filtered    uLOG calls below uLog::minLogLevel;
+//   uLOGF       without logger initialization (the file kept open in uLog::FileCache).
+// The latencies include the clock reads (see the "clock" row). Each destination runs in its own
+// process, with a new log file. N threads only with a threading library or MICRO_LOG_ASYNC.
+//
+// Usage:  microLog_bench [-n messages] [-t threads] [-d directory]... [-o results.csv]
+//         Defaults: 100000 messages per thread, hardware threads (max 8),
+//                   /dev/shm/ (tmpfs, if available) and the current directory,
+//                   results appended to microLog_bench.csv (and written to the standard output).
+
+#include "microLog.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _POSIX_VERSION
+	#include <sys/stat.h>
+	#include <sys/wait.h>
+#endif
+
+#if defined(MICRO_LOG_ASYNC) || (MICRO_LOG_THREADING != MICRO_LOG_SINGLE_THREAD)
+	#define uLOG_BENCH_THREADS
+#endif
+
+uLOG_INIT;
+
+
+struct Result
+{
+	std::string        name;
+	size_t             threads, messages;
+	double             seconds;
+	unsigned long long p50, p99, p999, max;     // ns
+};
+
+class Bench
+	/// Runs each case in throughput mode (no clock reads), then in latency mode
+{
+public:
+	Bench(const std::string &_dir, size_t _nMessages) : dir(_dir), nMessages(_nMessages) {}
+
+	template <class F>
+	Result Run(const std::string &name, size_t nThreads, size_t n, F call)
+	{
+		Result r = { name, nThreads, n * nThreads, 0, 0, 0, 0, 0 };
+
+		r.seconds = Threads(nThreads, [&](size_t t, std::vector<unsigned> *) {
+			for(size_t i = 0; i < n; ++i)
+				call(t, i);
+		}, nullptr);
+
+		std::vector<std::vector<unsigned>> latencies(nThreads, std::vector<unsigned>(n));
+		Threads(nThreads, [&](size_t t, std::vector<unsigned> *lat) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for(size_t i = 0; i < n; ++i) {
+				call(t, i);
+				const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+				(*lat)[i] = unsigned(std::min<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), ~0U));
+				start = end;
+			}
+		}, &latencies);
+
+		std::vector<unsigned> all;
+		all.reserve(n * nThreads);
+		for(size_t t = 0; t < nThreads; ++t)
+			all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+		r.p50  = Percentile(all, 0.5);
+		r.p99  = Percentile(all, 0.99);
+		r.p999 = Percentile(all, 0.999);
+		r.max  = all.empty() ? 0 : *std::max_element(all.begin(), all.end());
+		return r;
+	}
+
+	std::vector<Result> All(size_t nThreads)
+	{
+		std::vector<Result> results;
+
+		results.push_back(Run("clock", nThreads, nMessages, [](size_t, size_t) {}));
+
+		FILE *raw = std::fopen((dir + "microLog_bench_raw.log").c_str(), "a");
+		const bool flush = uLog::FlushPolicy::Always();
+		results.push_back(Run("fwrite", nThreads, nMessages, [&](size_t, size_t i) {
+			char line[256];
+			const int len = std::snprintf(line, sizeof(line), "2026-01-01 00:00:00  INFO      Benchmark message %zu, value %g\n", i, 3.14159 * double(i));
+			std::fwrite(line, 1, size_t(len), raw);
+			if(flush)
+				std::fflush(raw);
+		}));
+		std::fclose(raw);
+
+		static const char *presets[] = { "default", "detailed", "system", "debug", "verbose" };
+		static void (*setPresets[])() = { &uLog::LogFields::SetDefault, &uLog::LogFields::SetDetailed, &uLog::LogFields::SetSystem,
+		                                  &uLog::LogFields::SetDebug, &uLog::LogFields::SetVerbose };
+		uLog::minLogLevel = info;
+		for(int p = 0; p < 5; ++p) {
+			setPresets[p]();
+			results.push_back(Run(std::string("uLOG ") + presets[p], nThreads, nMessages, [](size_t, size_t i) {
+				uLOG(info) << "Benchmark message " << i << ", value " << 3.14159 * double(i) << uLOGE;
+			}));
+		}
+		uLog::LogFields::SetDefault();
+
+		results.push_back(Run("uLOGFMT", nThreads, nMessages, [](size_t, size_t i) {
+			uLOGFMT(info, "Benchmark message {}, value {}", i, 3.14159 * double(i));
+		}));
+
+		uLog::minLogLevel = warning;
+		results.push_back(Run("filtered", nThreads, nMessages, [](size_t, size_t i) {
+			uLOG(detail) << "Benchmark message " << i << ", value " << 3.14159 * double(i) << uLOGE;
+		}));
+		uLog::minLogLevel = info;
+
+		const std::string fname = dir + "microLog_bench_f.log";
+		results.push_back(Run("uLOGF", nThreads, nMessages, [&fname](size_t, size_t i) {
+			uLOGF(fname, info, info, "Benchmark message " << i << ", value " << 3.14159 * double(i));
+		}));
+
+		#ifdef MICRO_LOG_ASYNC
+		uLog::Async::Stop();         // the queued messages written
+		uLog::Async::Start();
+		#endif
+
+		std::remove((dir + "microLog_bench_raw.log").c_str());
+		std::remove(fname.c_str());
+		return results;
+	}
+
+private:
+	template <class F>
+	static double Threads(size_t nThreads, F body, std::vector<std::vector<unsigned>> *latencies)
+		// Run body in nThreads threads started together; elapsed seconds
+	{
+		std::atomic<size_t> ready(0);
+		std::atomic<bool>   go(false);
+		std::vector<std::thread> threads;
+		for(size_t t = 0; t < nThreads; ++t)
+			threads.push_back(std::thread([&, t]() {
+				++ready;
+				while(!go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				body(t, latencies ? &(*latencies)[t] : nullptr);
+			}));
+
+		while(ready.load() < nThreads)
+			std::this_thread::yield();
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+		for(size_t t = 0; t < nThreads; ++t)
+			threads[t].join();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static unsigned long long Percentile(std::vector<unsigned> &v, double q)
+	{
+		if(v.empty())
+			return 0;
+		std::vector<unsigned>::iterator nth = v.begin() + std::ptrdiff_t(q * double(v.size() - 1));
+		std::nth_element(v.begin(), nth, v.end());
+		return *nth;
+	}
+
+	std::string dir;
+	size_t      nMessages;
+};
+
+
+static std::string Mode()
+	// Logger options of this build
+{
+	std::string mode;
+	#ifdef MICRO_LOG_ASYNC
+	mode += "async ";
+	#endif
+	#ifdef MICRO_LOG_GROUP_COMMIT
+	mode += "group_commit ";
+	#endif
+	#ifdef MICRO_LOG_BINARY
+	mode += "binary ";
+	#endif
+	#ifdef MICRO_LOG_MMAP
+	mode += "mmap ";
+	#endif
+	#ifdef MICRO_LOG_ROTATION
+	mode += "rotation ";
+	#endif
+	#ifdef MICRO_LOG_TIERING
+	mode += "tiering ";
+	#endif
+	#ifdef MICRO_LOG_SINKS
+	mode += "sinks ";
+	#endif
+	#ifdef MICRO_LOG_CLIENT
+	mode += "client ";
+	#endif
+	#ifdef MICRO_LOG_LEVELS
+	mode += "levels ";
+	#endif
+	#ifdef MICRO_LOG_RELOAD
+	mode += "reload ";
+	#endif
+	#ifdef MICRO_LOG_RECORDER
+	mode += "recorder ";
+	#endif
+	#ifdef MICRO_LOG_COALESCE
+	mode += "coalesce ";
+	#endif
+	#if defined(MICRO_LOG_STRUCTURED) && MICRO_LOG_STRUCTURED == MICRO_LOG_JSON
+	mode += "json ";
+	#elif defined(MICRO_LOG_STRUCTURED)
+	mode += "logfmt ";
+	#endif
+	#ifdef MICRO_LOG_FIELDS
+	mode += "fields ";
+	#endif
+	return mode.empty() ? "sync" : mode.substr(0, mode.size() - 1);
+}
+
+static int RunDestination(const std::string &dir, size_t nMessages, const std::vector<size_t> &threadCounts, const std::string &csv)
+{
+	uLOG_START(dir + "microLog_bench.log", uLog::backup_overwrite);
+	if(uLog::loggerStatus < 0)
+		return 1;
+
+	Bench bench(dir, nMessages);
+	std::ostringstream rows;
+	for(size_t i = 0; i < threadCounts.size(); ++i) {
+		const std::vector<Result> results = bench.All(threadCounts[i]);
+		for(size_t j = 0; j < results.size(); ++j) {
+			const Result &r = results[j];
+			rows << Mode() << ',' << dir << ',' << r.threads << ',' << r.name << ',' << r.messages << ','
+			     << std::fixed << std::setprecision(6) << r.seconds << ',' << std::setprecision(0) << double(r.messages) / r.seconds << ','
+			     << r.p50 << ',' << r.p99 << ',' << r.p999 << ',' << r.max << '\n';
+		}
+	}
+
+	std::cout << rows.str() << std::flush;
+	std::ofstream(csv, std::fstream::app) << rows.str();
+
+	uLog::microLog_ofs.close();
+	std::remove((dir + "microLog_bench.log").c_str());
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t nMessages = 100000, nThreads = std::min(8U, std::max(2U, std::thread::hardware_concurrency()));
+	std::vector<std::string> dirs;
+	std::string csv = "microLog_bench.csv";
+
+	for(int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if(arg == "-n" && i + 1 < argc)
+			nMessages = std::stoul(argv[++i]);
+		else if(arg == "-t" && i + 1 < argc)
+			nThreads = std::stoul(argv[++i]);
+		else if(arg == "-d" && i + 1 < argc)
+			dirs.push_back(argv[++i]);
+		else if(arg == "-o" && i + 1 < argc)
+			csv = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [-n messages] [-t threads] [-d directory]... [-o results.csv]" << std::endl;
+			return 2;
+		}
+	}
+
+	if(dirs.empty()) {
+		#ifdef _POSIX_VERSION
+		struct stat st;
+		if(stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode))
+			dirs.push_back("/dev/shm/");
+		#endif
+		dirs.push_back("./");
+	}
+	for(size_t i = 0; i < dirs.size(); ++i)
+		if(dirs[i].back() != '/')
+			dirs[i] += '/';
+
+	std::vector<size_t> threadCounts(1, 1);
+	#ifdef uLOG_BENCH_THREADS
+	if(nThreads > 1)
+		threadCounts.push_back(nThreads);
+	#else
+	std::cerr << "Single threaded build (MICRO_LOG_SINGLE_THREAD): one thread only, not " << nThreads << "." << std::endl;
+	#endif
+
+	#ifndef __OPTIMIZE__
+	std::cerr << "Warning: built without optimizations." << std::endl;
+	#endif
+
+	std::ifstream exists(csv);
+	const bool header = !exists || exists.peek() == std::ifstream::traits_type::eof();
+	exists.close();
+	const char *columns = "mode,destination,threads,case,messages,seconds,messages_per_s,p50_ns,p99_ns,p999_ns,max_ns\n";
+	if(header)
+		std::ofstream(csv) << columns;
+	std::cout << columns;
+
+	int result = 0;
+	for(size_t i = 0; i < dirs.size(); ++i) {
+		#ifdef _POSIX_VERSION            // a new logger for each destination
+		std::cout.flush();
+		const pid_t child = fork();
+		if(child == 0)
+			std::exit(RunDestination(dirs[i], nMessages, threadCounts, csv));
+		int status = -1;
+		waitpid(child, &status, 0);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			std::cerr << "Cannot log to " << dirs[i] << std::endl;
+			result = 1;
+		}
+		#else
+		if(i == 0)
+			result = RunDestination(dirs[i], nMessages, threadCounts, csv);
+		#endif
+	}
+
+	return result;
+}
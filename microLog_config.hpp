@@ -21,6 +21,12 @@
     #define MICRO_LOG_MIN_LEVEL nolog
 #endif
 
+// Fields separator:
+
+#ifndef MICRO_LOG_SEPARATOR
+    #define MICRO_LOG_SEPARATOR "  "
+#endif
+
 // Minimum log levels for specific code areas:
 
 namespace uLog {
@@ -35,7 +41,7 @@ namespace uLog {
 	    logConstLevel1 = detail,
 	    logConstLevel2 = warning;
 
-	static const char separator[] = "  ";
+	static const char separator[] = MICRO_LOG_SEPARATOR;
 }
 
 #define MICRO_LOG_LEVEL1 warning
@@ -54,6 +60,9 @@ namespace uLog {
 	#define MICRO_LOG_EXECUTABLE_NAME "Phoenix"
 #endif
 
+/// Select the log message fields at compile time (faster), instead of at run time with uLog::LogFields
+//#define MICRO_LOG_FIELDS MICRO_LOG_FIELDS_SYSTEM
+
 /// Specify one threading library to be used
 #ifndef MICRO_LOG_THREADING
 	#define MICRO_LOG_THREADING MICRO_LOG_SINGLE_THREAD
@@ -0,0 +1,250 @@
+/// microLog_decode.cpp
+
+// Converts a binary log file, written with MICRO_LOG_BINARY, to the microLog text format.
+//
+// Usage:  microLog_decode binary_log_file [text_log_file]
+//         Without text_log_file, the text is written to the standard output.
+
+#define MICRO_LOG_BOOST 0       // no space checks: nothing is logged
+
+#include "microLog.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+uLOG_INIT;
+
+using uLog::BinaryLog;
+
+
+struct SiteInfo
+{
+	std::string file, fileName, func, funcSig, line;
+};
+
+class Decoder
+	/// Reads the binary records, and writes each message as microLog would have written it
+{
+public:
+	Decoder(std::istream &_in, std::ostream &_out) : in(_in), out(_out), separator(uLog::separator), nUnknown(0) {}
+
+	int Run()
+	{
+		std::vector<char> payload;
+		char head[BinaryLog::recordHead];
+
+		while(SkipZeros(), in.read(head, sizeof(head))) {
+			unsigned short len;
+			BinaryLog::Get(head + 1, len);
+			payload.resize(size_t(len) + 1);
+			if(!in.read(&payload[0], len)) {
+				std::cerr << "Truncated record at the end of the log." << std::endl;
+				return 1;
+			}
+
+			bool ok = false;
+			switch(head[0]) {
+			case BinaryLog::header:  ok = Header(&payload[0], len);  break;
+			case BinaryLog::site:    ok = Site(&payload[0], len);    break;
+			case BinaryLog::message: ok = Message(&payload[0], len); break;
+			case BinaryLog::text:    ok = Text(&payload[0], len);    break;
+			}
+			if(!ok) {
+				std::cerr << "Invalid record (type " << int(head[0]) << ", " << len << " bytes)." << std::endl;
+				return 1;
+			}
+		}
+
+		if(nUnknown)
+			std::cerr << nUnknown << " messages of unknown call sites skipped." << std::endl;
+		return 0;
+	}
+
+private:
+	void SkipZeros() {
+		// Zeros in place of records: a memory mapped log after a crash or a mapping failure (see MappedFile)
+		while(in.peek() == 0)
+			in.get();
+	}
+
+	static bool GetString(const char *&p, const char *end, std::string &s) {
+		unsigned short len;
+		if(end - p < 2) return false;
+		p = BinaryLog::Get(p, len);
+		if(end - p < len) return false;
+		s.assign(p, len);
+		p += len;
+		return true;
+	}
+
+	bool Header(const char *p, size_t len)
+	{
+		const char *end = p + len;
+		unsigned char version;
+		unsigned short byteOrder;
+
+		if(len < 15 || std::string(p, 4) != BinaryLog::Magic())
+			return false;
+		p = BinaryLog::Get(p + 4, version);
+		p = BinaryLog::Get(p, byteOrder);
+		if(version != BinaryLog::version || byteOrder != BinaryLog::byteOrder) {
+			std::cerr << "Unsupported log: version " << int(version) << ", byte order mark " << byteOrder << "." << std::endl;
+			return false;
+		}
+		p = BinaryLog::Get(p, uLog::Timestamp::Origin().wallNs);
+
+		return GetString(p, end, separator) && GetString(p, end, exec) && GetString(p, end, pid) &&
+		       GetString(p, end, uid) && GetString(p, end, uname);
+	}
+
+	bool Site(const char *p, size_t len)
+	{
+		const char *end = p + len;
+		unsigned id, line;
+
+		if(len < 8) return false;
+		p = BinaryLog::Get(p, id);
+		p = BinaryLog::Get(p, line);
+
+		SiteInfo &site = sites[id];
+		site.line = std::to_string(line);
+		if(!GetString(p, end, site.file) || !GetString(p, end, site.func) || !GetString(p, end, site.funcSig))
+			return false;
+		site.fileName = site.file.substr(uLog::BaseNameOffset(site.file.c_str()));
+		return true;
+	}
+
+	bool Text(const char *p, size_t len)
+	{
+		if(len < 1) return false;
+		out.write(p + 1, std::streamsize(len - 1));
+		return true;
+	}
+
+	bool Message(const char *p, size_t len)
+	{
+		const char *end = p + len;
+		unsigned id;
+		unsigned char level, precision;
+		unsigned short fields;
+		long long now;
+
+		if(len < BinaryLog::messageHead - BinaryLog::recordHead) return false;
+		p = BinaryLog::Get(p, id);
+		p = BinaryLog::Get(p, level);
+		p = BinaryLog::Get(p, precision);
+		p = BinaryLog::Get(p, fields);
+		p = BinaryLog::Get(p, now);
+
+		std::map<unsigned, SiteInfo>::const_iterator site = sites.find(id);
+		if(site == sites.end()) {         // its record dropped (no space, segment not mapped)
+			++nUnknown;
+			return true;
+		}
+
+		// Prefix, as in uLog::BeginLog()
+		std::string text;
+		char ts[uLog::Timestamp::maxLen];
+		if(fields & MICRO_LOG_FIELD_TIME)
+			text.append(ts, uLog::Timestamp::FormatElapsed(ts, now));
+		if(fields & MICRO_LOG_FIELD_DATE) {
+			uLog::Timestamp::Precision() = precision;
+			text.append(ts, uLog::Timestamp::FormatDate(ts, now));
+		}
+		if(fields & MICRO_LOG_FIELD_LEVEL)
+			text.append(uLog::logLevelTags[level < uLog::nLogLevels ? level : 0]).append(separator);
+		if(fields & MICRO_LOG_FIELD_EXEC)      text += exec;
+		if(fields & MICRO_LOG_FIELD_PID)       text += pid;
+		if(fields & MICRO_LOG_FIELD_UID)       text += uid;
+		if(fields & MICRO_LOG_FIELD_UNAME)     text += uname;
+		if(fields & MICRO_LOG_FIELD_FILE_NAME) text.append(site->second.fileName).append(separator);
+		if(fields & MICRO_LOG_FIELD_FILE_PATH) text.append(site->second.file).append(separator);
+		if(fields & MICRO_LOG_FIELD_FUNC_NAME) text.append(site->second.func).append(separator);
+		if(fields & MICRO_LOG_FIELD_FUNC_SIG)  text.append(site->second.funcSig).append(separator);
+		if(fields & MICRO_LOG_FIELD_LINE)      text.append(site->second.line).append(separator);
+		text += ": ";
+
+		// Arguments, formatted as by the uLog::Record insertion operators
+		while(p < end) {
+			const char tag = *p++;
+			std::string s;
+			long long i;
+			unsigned long long u;
+			double d;
+			char num[32];
+
+			switch(tag) {
+			case BinaryLog::argSigned:
+				if(end - p < 8) return false;
+				p = BinaryLog::Get(p, i);
+				text += std::to_string(i);
+				break;
+			case BinaryLog::argUnsigned:
+				if(end - p < 8) return false;
+				p = BinaryLog::Get(p, u);
+				text += std::to_string(u);
+				break;
+			case BinaryLog::argDouble:
+				if(end - p < 8) return false;
+				p = BinaryLog::Get(p, d);
+				std::snprintf(num, sizeof(num), "%g", d);
+				text += num;
+				break;
+			case BinaryLog::argChar:
+				if(end - p < 1) return false;
+				text += *p++;
+				break;
+			case BinaryLog::argBool:
+				if(end - p < 1) return false;
+				text += *p++ ? '1' : '0';
+				break;
+			case BinaryLog::argString:
+				if(!GetString(p, end, s)) return false;
+				text += s;
+				break;
+			default:
+				return false;
+			}
+		}
+
+		text += '\n';
+		out.write(text.data(), std::streamsize(text.size()));
+		return true;
+	}
+
+	std::istream &in;
+	std::ostream &out;
+	std::string   separator, exec, pid, uid, uname;    // from the last header
+	std::map<unsigned, SiteInfo> sites;
+	size_t        nUnknown;                            // messages of unknown call sites, skipped
+};
+
+
+int main(int argc, char *argv[])
+{
+	if(argc < 2 || argc > 3) {
+		std::cerr << "Usage: " << argv[0] << " binary_log_file [text_log_file]" << std::endl;
+		return 2;
+	}
+
+	std::ifstream in(argv[1], std::ios_base::binary);
+	if(!in) {
+		std::cerr << "Cannot open " << argv[1] << std::endl;
+		return 2;
+	}
+
+	if(argc == 3) {
+		std::ofstream out(argv[2]);
+		if(!out) {
+			std::cerr << "Cannot open " << argv[2] << std::endl;
+			return 2;
+		}
+		return Decoder(in, out).Run();
+	}
+
+	return Decoder(in, std::cout).Run();
+}
@@ -0,0 +1,371 @@
+/// microLog_server.cpp
+
+// Log server for the processes built with MICRO_LOG_CLIENT (Linux).
+// Each client sends at attach a ring in shared memory, where its messages are queued, and an eventfd
+// to signal new messages when the server is waiting. The server writes the messages to the client's
+// log file, shared by all the clients with the same file.
+// The messages to main_log are written through microLog, with the features this program is built
+// with (rotation, tiering, flush policy, space checks); the server's own messages go there too.
+// The other files are only appended to (no rotation, backup nor space checks), and only in log_dir
+// (not through a symbolic link): a client asking for another file is rejected, and then writes its
+// log file itself. Only the processes of the server's user, of root and of the -u users are attached.
+//
+// Usage:  microLog_server [-s socket] [-l main_log] [-d log_dir] [-u uid]...
+//         Defaults: MICRO_LOG_SERVER_SOCKET, microLog_server.log, no log_dir (main_log only)
+//         SIGINT, SIGTERM: write the queued messages and exit.
+
+#undef  MICRO_LOG_CLIENT        // the server writes the files itself
+#define MICRO_LOG_SERVER
+
+#include "microLog.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+uLOG_INIT;
+
+using uLog::SharedRing;
+
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+extern "C" void OnStopSignal(int) {
+	stopRequested = 1;
+}
+
+
+class Server
+{
+public:
+	Server(const std::string &_socketPath, const std::string &_mainLog, const std::string &_logDir,
+	       const std::vector<uid_t> &_users) :
+		socketPath(_socketPath), mainLog(_mainLog), logDir(_logDir), users(_users), listenFd(-1) {}
+
+	~Server()
+	{
+		for(size_t i = 0; i < clients.size(); ++i)
+			Drop(clients[i]);
+		if(listenFd >= 0) {
+			close(listenFd);
+			unlink(socketPath.c_str());
+		}
+	}
+
+	int Run()
+	{
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if(socketPath.size() >= sizeof(addr.sun_path)) {
+			std::cerr << "Socket path too long: " << socketPath << std::endl;
+			return 2;
+		}
+		std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+		unlink(socketPath.c_str());                 // left by a previous server
+		listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if(listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+			std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+			return 2;
+		}
+		uLOG(info) << "Log server listening on " << socketPath << uLOGE;
+
+		std::vector<struct pollfd> fds;
+		while(!stopRequested) {
+			// Sleep only if all the rings are empty (see SharedRing)
+			bool pending = DrainAll();
+			for(size_t i = 0; i < clients.size(); ++i)
+				if(clients[i].ring) clients[i].ring->sleeping.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			for(size_t i = 0; i < clients.size() && !pending; ++i)
+				pending = clients[i].ring && !clients[i].ring->Empty(clients[i].cursor);
+
+			fds.clear();
+			struct pollfd p = { listenFd, POLLIN, 0 };
+			fds.push_back(p);
+			for(size_t i = 0; i < clients.size(); ++i) {
+				p.fd = clients[i].sock;    fds.push_back(p);
+				p.fd = clients[i].eventFd; fds.push_back(p);
+			}
+			const int n = poll(&fds[0], fds.size(), pending ? 0 : 100);
+
+			for(size_t i = 0; i < clients.size(); ++i)
+				if(clients[i].ring) clients[i].ring->sleeping.store(0, std::memory_order_relaxed);
+			if(n <= 0)
+				continue;
+
+			if(fds[0].revents & POLLIN) {
+				const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+				if(fd >= 0) {
+					Client c = {};
+					c.sock = fd;
+					c.eventFd = -1;
+					clients.push_back(c);              // polled from the next round
+				}
+			}
+
+			for(size_t i = 0, k = 1; i < clients.size() && k < fds.size(); ++i, k += 2) {
+				Client &c = clients[i];
+				if(fds[k + 1].revents & POLLIN) {
+					unsigned long long count;
+					if(read(c.eventFd, &count, sizeof(count))) {}
+				}
+				if(fds[k].revents & (POLLIN | POLLHUP | POLLERR))
+					c.closed = !(c.ring ? Request(c) : Attach(c));
+			}
+
+			for(size_t i = clients.size(); i-- > 0; )
+				if(clients[i].closed) {
+					Drop(clients[i]);
+					clients.erase(clients.begin() + std::ptrdiff_t(i));
+				}
+		}
+
+		uLOG(info) << "Log server stopped" << uLOGE;
+		return 0;
+	}
+
+private:
+	struct Output {
+		std::ofstream ofs;
+		int           nClients;
+		bool          written;
+	};
+
+	struct Client {
+		int         sock, eventFd, pid;
+		SharedRing *ring;
+		size_t      size;
+		SharedRing::Cursor cursor; // not in the ring: the client can overwrite its header
+		Output     *out;          // nullptr: mainLog
+		std::string logFilename;
+		bool        closed;
+	};
+
+	bool Attach(Client &c)
+		// First message of a client: SharedRing::Hello, with the ring memfd and eventfd
+	{
+		SharedRing::Hello hello;
+		int fds[2] = { -1, -1 };
+		char control[CMSG_SPACE(sizeof(fds))] = {};
+		struct iovec iov = { &hello, sizeof(hello) };
+		struct msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		const ssize_t len = recvmsg(c.sock, &msg, MSG_CMSG_CLOEXEC);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+			std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+		c.eventFd = fds[1];
+
+		struct stat st;
+		bool ok = Allowed(c) && len == ssize_t(sizeof(hello)) && fds[0] >= 0 && fds[1] >= 0 &&
+		          std::memcmp(hello.magic, SharedRing::Magic(), sizeof(hello.magic)) == 0 &&
+		          hello.version == SharedRing::version && fstat(fds[0], &st) == 0;
+		if(ok) {
+			void *shared = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+			if(shared != MAP_FAILED) {
+				c.ring = static_cast<SharedRing*>(shared);
+				c.size = size_t(st.st_size);
+			}
+			ok = c.ring && c.ring->Valid(c.size) && c.ring->nSlots == hello.nSlots;
+			c.cursor.nSlots = hello.nSlots;
+			c.cursor.dequeuePos = 0;
+		}
+		if(fds[0] >= 0)
+			close(fds[0]);
+		if(!ok) {
+			uLOG(warning) << "Invalid attach request rejected" << uLOGE;
+			return false;
+		}
+
+		hello.logFilename[sizeof(hello.logFilename) - 1] = 0;
+		c.logFilename = hello.logFilename;
+		if(!Permitted(c.logFilename)) {
+			uLOG(warning) << "Process " << c.pid << " rejected: log file " << c.logFilename << " not in the log directory" << uLOGE;
+			return false;
+		}
+		if(c.logFilename != mainLog) {
+			Output &out = outputs[c.logFilename];
+			if(!out.ofs.is_open()) {
+				out.ofs.open(c.logFilename.c_str(), uLOG_OPEN_MODE);
+				out.nClients = 0;
+				out.written = false;
+			}
+			if(!out.ofs) {
+				uLOG(error) << "Cannot open " << c.logFilename << " for process " << c.pid << uLOGE;
+				outputs.erase(c.logFilename);
+				return false;
+			}
+			++out.nClients;
+			c.out = &out;
+		}
+
+		uLOG(info) << "Process " << c.pid << " attached, log file: " << c.logFilename << uLOGE;
+		return send(c.sock, "A", 1, MSG_NOSIGNAL) == 1;
+	}
+
+	bool Allowed(Client &c)
+		// Peer credentials of the client: its user must be allowed; its pid is taken from them
+	{
+		struct ucred cred;
+		socklen_t credLen = sizeof(cred);
+		if(getsockopt(c.sock, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) != 0 || credLen != sizeof(cred))
+			return false;
+		c.pid = cred.pid;
+		if(cred.uid == 0 || cred.uid == geteuid())
+			return true;
+		for(size_t i = 0; i < users.size(); ++i)
+			if(cred.uid == users[i])
+				return true;
+		uLOG(warning) << "Process " << cred.pid << " of user " << cred.uid << " not allowed" << uLOGE;
+		return false;
+	}
+
+	bool Permitted(const std::string &path) const
+		// A client's log file: mainLog, or a regular file directly in logDir
+	{
+		if(path == mainLog)
+			return true;
+		const size_t slash = path.rfind('/');
+		if(logDir.empty() || slash == std::string::npos || slash + 1 == path.size())
+			return false;
+		char dir[PATH_MAX];
+		struct stat st;
+		return realpath(path.substr(0, slash ? slash : 1).c_str(), dir) && logDir == dir &&
+		       (lstat(path.c_str(), &st) != 0 || S_ISREG(st.st_mode));
+	}
+
+	bool Request(Client &c)
+		// Detach request, or connection closed: false to drop the client
+	{
+		char cmd = 0;
+		const ssize_t len = recv(c.sock, &cmd, 1, MSG_DONTWAIT);
+		if(len < 0 && errno == EAGAIN)
+			return true;
+		Drain(c);
+		Flush();
+		if(len == 1 && cmd == 'D') {
+			uLOG(info) << "Process " << c.pid << " detached" << uLOGE;
+			if(send(c.sock, "D", 1, MSG_NOSIGNAL)) {}
+		}
+		else
+			uLOG(warning) << "Process " << c.pid << " disconnected without detaching" << uLOGE;
+		return false;
+	}
+
+	size_t Drain(Client &c)
+	{
+		if(!c.ring)
+			return 0;
+
+		char buf[uLog::maxLogSize];
+		int level;
+		size_t len, n = 0;
+		while((len = c.ring->Pop(c.cursor, buf, level)) != 0) {
+			if(c.out) {
+				c.out->ofs.write(buf, std::streamsize(len));
+				c.out->written = true;
+			}
+			else
+				uLog::Write(&uLog::microLog_ofs, level, buf, len, false);
+			++n;
+		}
+		return n;
+	}
+
+	bool DrainAll()
+		// true if some ring still has messages
+	{
+		bool more = false;
+		for(size_t i = 0; i < clients.size(); ++i)
+			more |= clients[i].ring && Drain(clients[i]) >= clients[i].cursor.nSlots / 2;
+		Flush();
+		return more;
+	}
+
+	void Flush()
+	{
+		for(std::map<std::string, Output>::iterator it = outputs.begin(); it != outputs.end(); ++it)
+			if(it->second.written) {
+				it->second.ofs.flush();
+				it->second.written = false;
+			}
+	}
+
+	void Drop(Client &c)
+	{
+		Drain(c);
+		if(c.out && --c.out->nClients == 0)
+			outputs.erase(c.logFilename);
+		c.out = nullptr;
+		if(c.ring)           munmap(c.ring, c.size);
+		if(c.eventFd >= 0)   close(c.eventFd);
+		if(c.sock >= 0)      close(c.sock);
+		c.ring = nullptr;
+		c.sock = c.eventFd = -1;
+	}
+
+	std::string socketPath, mainLog, logDir;     // logDir: real path (empty: mainLog only)
+	std::vector<uid_t> users;                    // allowed besides the server's user and root
+	int listenFd;
+	std::vector<Client> clients;
+	std::map<std::string, Output> outputs;
+};
+
+
+int main(int argc, char *argv[])
+{
+	std::string socketPath = MICRO_LOG_SERVER_SOCKET, mainLog = "microLog_server.log", logDir;
+	std::vector<uid_t> users;
+
+	for(int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if(arg == "-s" && i + 1 < argc)
+			socketPath = argv[++i];
+		else if(arg == "-l" && i + 1 < argc)
+			mainLog = argv[++i];
+		else if(arg == "-d" && i + 1 < argc)
+			logDir = argv[++i];
+		else if(arg == "-u" && i + 1 < argc)
+			users.push_back(uid_t(std::strtoul(argv[++i], nullptr, 10)));
+		else {
+			std::cerr << "Usage: " << argv[0] << " [-s socket] [-l main_log] [-d log_dir] [-u uid]..." << std::endl;
+			return 2;
+		}
+	}
+
+	char dir[PATH_MAX];
+	if(!logDir.empty()) {
+		if(!realpath(logDir.c_str(), dir)) {
+			std::cerr << "Invalid log directory: " << logDir << std::endl;
+			return 2;
+		}
+		logDir = dir;
+	}
+
+	char cwd[PATH_MAX];
+	if(mainLog[0] != '/')                            // as the clients' file names
+		mainLog = std::string(getcwd(cwd, sizeof(cwd)) ? cwd : ".") + "/" + mainLog;
+
+	std::signal(SIGINT, OnStopSignal);
+	std::signal(SIGTERM, OnStopSignal);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	uLOG_START(mainLog, uLog::backup_append);
+	if(uLog::loggerStatus < 0)
+		return 2;
+
+	return Server(socketPath, mainLog, logDir, users).Run();
+}